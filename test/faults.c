@@ -0,0 +1,311 @@
+/*
+ * $Id$
+ *
+ * Copyright (c) 2011 Takashi TOYOSHIMA <toyoshim@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Fault scenarios of the YUREX driver on the simulated usb stack */
+
+#include <string.h>
+#include <sys/resource.h>
+
+#include "yurex.h"
+#include "sim.h"
+
+// time limits
+static const bigtime_t kQuiet = 20000;		// usec, deferred work
+static const bigtime_t kRecoveryLimit = 2000000;	// usec, > max backoff
+
+// fault scenario, the fault function starts from a settled device, and
+// the runner beats once afterwards and waits for the count to recover
+typedef struct _scenario {
+	const char *name;		// scenario name
+	void      (*fault)(sim_device *sim, void *bbu);	// fault function
+	int         removes;		// device is gone after the fault?
+} scenario;
+
+//
+// node helpers
+//
+
+static void *
+node_open
+(sim_device *sim, const char *node)
+{
+	char path[256];
+	void *cookie = NULL;
+
+	sim_path(sim, node, path, sizeof(path));
+	publish_devices();
+	if (B_OK != find_device(path)->open(path, 0, &cookie))
+		return NULL;
+	return cookie;
+}
+
+static void
+node_close
+(void *cookie)
+{
+	device_hooks *hooks = find_device("");
+
+	hooks->close(cookie);
+	hooks->free(cookie);
+}
+
+static uint64
+node_read
+(void *cookie)
+{
+	char buf[32];
+	size_t len = sizeof(buf) - 1;
+
+	if (B_OK != find_device("")->read(cookie, 0, buf, &len))
+		return (uint64)-1;
+	buf[len] = '\0';
+	return strtoull(buf, NULL, 10);
+}
+
+static status_t
+node_write
+(void *cookie, uint64 value)
+{
+	char buf[32];
+	size_t len = snprintf(buf, sizeof(buf), "%" B_PRIu64 "\n", value);
+
+	return find_device("")->write(cookie, 0, buf, &len);
+}
+
+static status_t
+node_stats
+(void *cookie, yurex_stats *stats)
+{
+	memset(stats, 0, sizeof(yurex_stats));
+	return find_device("")->control(cookie, YUREX_GET_STATS, stats,
+		sizeof(yurex_stats));
+}
+
+static bigtime_t
+cpu_time
+(void)
+{
+	// user and system time of the process (usec)
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	return (bigtime_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) *
+		1000000 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+//
+// fault functions
+//
+
+static void
+fault_queue_fail
+(sim_device *sim, void *bbu)
+{
+	// the requeue after a report fails a few times
+	sim_fail_queues(sim, 3);
+	sim_beat(sim, 1);
+	sim_pump(sim);
+}
+
+static void
+fault_error_status
+(sim_device *sim, void *bbu)
+{
+	int i;
+
+	for (i = 0; i < 3; i++)
+		sim_push(sim, NULL, 0, B_DEV_CRC_ERROR);
+	sim_pump(sim);
+}
+
+static void
+fault_stall
+(sim_device *sim, void *bbu)
+{
+	// the endpoint halt is cleared before the transfer is requeued
+	sim_push(sim, NULL, 0, B_DEV_STALLED);
+	sim_pump(sim);
+}
+
+static void
+fault_truncated
+(sim_device *sim, void *bbu)
+{
+	uint8 report[SIM_REPORT_SIZE];
+
+	sim_report(report, SIM_CMD_VALUE, sim_counter(sim) + 1);
+	sim_push(sim, report, 4, B_OK);
+	sim_pump(sim);
+}
+
+static void
+fault_no_eof
+(sim_device *sim, void *bbu)
+{
+	uint8 report[SIM_REPORT_SIZE];
+
+	sim_report(report, SIM_CMD_VALUE, sim_counter(sim) + 1);
+	report[6] = 0;
+	sim_push(sim, report, sizeof(report), B_OK);
+	sim_pump(sim);
+}
+
+static void
+fault_drop_request
+(sim_device *sim, void *bbu)
+{
+	// the write request never reaches the device
+	sim_fail_requests(sim, 1);
+	node_write(bbu, 1000);
+	sim_settle(kQuiet);
+}
+
+static void
+fault_slow_request
+(sim_device *sim, void *bbu)
+{
+	sim_stall(sim, 50000);
+	node_write(bbu, 2000);
+	sim_stall(sim, 0);
+}
+
+static void
+fault_delay_ack
+(sim_device *sim, void *bbu)
+{
+	sim_delay_acks(sim, 100000);
+	node_write(bbu, 3000);
+	sim_delay_acks(sim, 0);
+}
+
+static void
+fault_drop_ack
+(sim_device *sim, void *bbu)
+{
+	// resolved by the write timeout
+	sim_drop_acks(sim, 1);
+	node_write(bbu, 4000);
+}
+
+static void
+fault_remove_in_callback
+(sim_device *sim, void *bbu)
+{
+	// device_removed runs before the callback of the last report
+	sim_remove_in_callback(sim);
+	sim_beat(sim, 1);
+	sim_pump(sim);
+}
+
+static const scenario kScenarios[] = {
+	{ "queue_fail", fault_queue_fail, 0 },
+	{ "error_status", fault_error_status, 0 },
+	{ "stall", fault_stall, 0 },
+	{ "truncated", fault_truncated, 0 },
+	{ "no_eof", fault_no_eof, 0 },
+	{ "drop_request", fault_drop_request, 0 },
+	{ "slow_request", fault_slow_request, 0 },
+	{ "delay_ack", fault_delay_ack, 0 },
+	{ "drop_ack", fault_drop_ack, 0 },
+	{ "remove_in_callback", fault_remove_in_callback, 1 },
+	{ NULL, NULL, 0 }
+};
+
+//
+// scenario runner
+//
+
+static int
+scenario_run
+(const scenario *s)
+{
+	// returns 0 if the device recovered, or went away cleanly
+	sim_device *sim = sim_attach(8);
+	void *bbu = node_open(sim, "bbu");
+	int32 errors = sim_errors();
+	yurex_stats stats;
+	bigtime_t cpu;
+	bigtime_t start;
+	int ok;
+
+	if (NULL == bbu) {
+		printf("%-20s %-9s\n", s->name, "no node");
+		sim_detach(sim);
+		return 1;
+	}
+	sim_settle(kQuiet);
+	cpu = cpu_time();
+	start = system_time();
+	s->fault(sim, bbu);
+
+	if (0 != s->removes) {
+		// the last report is still published, the node stays safe to use
+		sim_settle(kQuiet);
+		ok = (node_read(bbu) == sim_counter(sim)) &&
+			(B_DEV_NOT_READY == node_stats(bbu, &stats));
+		cpu = cpu_time() - cpu;
+		printf("%-20s %-9s %6s %10s %10s %10" B_PRId64 "\n", s->name,
+			(0 != ok)? "gone": "FAIL", "-", "-", "-", cpu);
+	} else {
+		sim_beat(sim, 1);
+		do {
+			if (0 == sim_pump(sim))
+				snooze(1000);
+			ok = (node_read(bbu) == sim_counter(sim));
+		} while ((0 == ok) && (system_time() - start < kRecoveryLimit));
+		cpu = cpu_time() - cpu;
+		node_stats(bbu, &stats);
+		printf("%-20s %-9s %6" B_PRIu64 " %10" B_PRId64 " %10" B_PRId64
+			" %10" B_PRId64 "\n", s->name, (0 != ok)? "yes": "FAIL",
+			stats.lost_updates, stats.last_recovery, stats.max_recovery, cpu);
+	}
+	fflush(stdout);
+
+	node_close(bbu);
+	sim_detach(sim);
+	return ((0 != ok) && (errors == sim_errors()))? 0: 1;
+}
+
+int
+main
+(int argc, char **argv)
+{
+	const scenario *s;
+	int failures = 0;
+
+	if (B_OK != init_driver()) {
+		fprintf(stderr, "init_driver failed\n");
+		return 1;
+	}
+	printf("%-20s %-9s %6s %10s %10s %10s\n", "SCENARIO", "RECOVERED",
+		"LOST", "LAST(us)", "MAX(us)", "CPU(us)");
+	for (s = kScenarios; NULL != s->name; s++) {
+		if ((1 < argc) && (0 != strcmp(argv[1], s->name)))
+			continue;
+		failures += scenario_run(s);
+	}
+	uninit_driver();
+
+	if ((0 != failures) || (0 != sim_threads()) || (0 != sim_sems()) ||
+		(0 != sim_errors())) {
+		printf("FAIL: failures=%d threads=%" B_PRId32 " sems=%" B_PRId32
+			"\n", failures, sim_threads(), sim_sems());
+		return 1;
+	}
+	return 0;
+}
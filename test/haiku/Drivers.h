@@ -0,0 +1,53 @@
+/*
+ * $Id$
+ *
+ * Copyright (c) 2011 Takashi TOYOSHIMA <toyoshim@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Host stand-in for the Haiku header, only what the driver uses */
+
+#ifndef _DRIVERS_H
+#define _DRIVERS_H
+
+#include <OS.h>
+
+#define B_CUR_DRIVER_API_VERSION	2
+#define B_DEVICE_OP_CODES_END		9999
+
+typedef status_t (*device_open_hook)(const char *name, uint32 flags,
+	void **cookie);
+typedef status_t (*device_close_hook)(void *cookie);
+typedef status_t (*device_free_hook)(void *cookie);
+typedef status_t (*device_control_hook)(void *cookie, uint32 op, void *data,
+	size_t len);
+typedef status_t (*device_read_hook)(void *cookie, off_t position,
+	void *data, size_t *numBytes);
+typedef status_t (*device_write_hook)(void *cookie, off_t position,
+	const void *data, size_t *numBytes);
+
+typedef struct {
+	device_open_hook    open;
+	device_close_hook   close;
+	device_free_hook    free;
+	device_control_hook control;
+	device_read_hook    read;
+	device_write_hook   write;
+	void               *select;
+	void               *deselect;
+	void               *readv;
+	void               *writev;
+} device_hooks;
+
+#endif // _DRIVERS_H
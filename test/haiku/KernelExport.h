@@ -0,0 +1,44 @@
+/*
+ * $Id$
+ *
+ * Copyright (c) 2011 Takashi TOYOSHIMA <toyoshim@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Host stand-in for the Haiku header, implemented by sim.c */
+
+#ifndef _KERNEL_EXPORT_H
+#define _KERNEL_EXPORT_H
+
+#include <OS.h>
+
+// kernel log goes to stderr when YUREX_SIM_TRACE is set
+#define dprintf sim_dprintf
+void sim_dprintf(const char *format, ...);
+
+thread_id spawn_kernel_thread(thread_func function, const char *name,
+	int32 priority, void *arg);
+status_t user_memcpy(void *to, const void *from, size_t size);
+
+// modules
+typedef struct module_info {
+	const char *name;
+	uint32      flags;
+	status_t    (*std_ops)(int32, ...);
+} module_info;
+
+status_t get_module(const char *path, module_info **info);
+status_t put_module(const char *path);
+
+#endif // _KERNEL_EXPORT_H
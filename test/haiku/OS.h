@@ -0,0 +1,67 @@
+/*
+ * $Id$
+ *
+ * Copyright (c) 2011 Takashi TOYOSHIMA <toyoshim@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Host stand-in for the Haiku header, implemented by sim.c */
+
+#ifndef _OS_H
+#define _OS_H
+
+#include <SupportDefs.h>
+
+typedef int32 sem_id;
+typedef int32 port_id;
+typedef int32 thread_id;
+typedef status_t (*thread_func)(void *data);
+
+#define B_OS_NAME_LENGTH		32
+#define B_INFINITE_TIMEOUT		(9223372036854775807LL)
+#define B_CAN_INTERRUPT			0x01
+#define B_RELATIVE_TIMEOUT		0x08
+#define B_ABSOLUTE_TIMEOUT		0x10
+#define B_NORMAL_PRIORITY		10
+#define B_URGENT_DISPLAY_PRIORITY	20
+#define B_SYSTEM_TIMEBASE		0
+
+// semaphores
+sem_id create_sem(int32 count, const char *name);
+status_t delete_sem(sem_id id);
+status_t acquire_sem(sem_id id);
+status_t acquire_sem_etc(sem_id id, int32 count, uint32 flags,
+	bigtime_t timeout);
+status_t release_sem(sem_id id);
+status_t release_sem_etc(sem_id id, int32 count, uint32 flags);
+
+// ports
+port_id create_port(int32 capacity, const char *name);
+status_t delete_port(port_id port);
+ssize_t port_count(port_id port);
+status_t write_port_etc(port_id port, int32 code, const void *buffer,
+	size_t bufferSize, uint32 flags, bigtime_t timeout);
+ssize_t read_port_etc(port_id port, int32 *code, void *buffer,
+	size_t bufferSize, uint32 flags, bigtime_t timeout);
+
+// threads
+status_t resume_thread(thread_id thread);
+status_t wait_for_thread(thread_id thread, status_t *returnValue);
+
+// time
+bigtime_t system_time(void);
+status_t snooze(bigtime_t amount);
+status_t snooze_until(bigtime_t time, int timeBase);
+
+#endif // _OS_H
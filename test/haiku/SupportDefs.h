@@ -0,0 +1,91 @@
+/*
+ * $Id$
+ *
+ * Copyright (c) 2011 Takashi TOYOSHIMA <toyoshim@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Host stand-in for the Haiku header, only what the driver uses */
+
+#ifndef _SUPPORT_DEFS_H
+#define _SUPPORT_DEFS_H
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+typedef int8_t   int8;
+typedef uint8_t  uint8;
+typedef int16_t  int16;
+typedef uint16_t uint16;
+typedef int32_t  int32;
+typedef uint32_t uint32;
+typedef int64_t  int64;
+typedef uint64_t uint64;
+typedef int32    status_t;
+typedef int64    bigtime_t;
+
+#define B_PRId32	PRId32
+#define B_PRIu32	PRIu32
+#define B_PRId64	PRId64
+#define B_PRIu64	PRIu64
+
+// error codes, values as in Errors.h
+#define B_OK			((status_t)0)
+#define B_ERROR			((status_t)-1)
+#define B_NO_MEMORY		((status_t)0x80000000)
+#define B_BAD_VALUE		((status_t)0x80000005)
+#define B_TIMED_OUT		((status_t)0x80000009)
+#define B_WOULD_BLOCK		((status_t)0x8000000b)
+#define B_NO_MORE_SEMS		((status_t)0x80001000)
+#define B_BAD_SEM_ID		((status_t)0x80001001)
+#define B_NO_MORE_PORTS		((status_t)0x80001005)
+#define B_BAD_PORT_ID		((status_t)0x80001006)
+#define B_BAD_THREAD_ID		((status_t)0x80001101)
+#define B_NO_MORE_THREADS	((status_t)0x80001103)
+#define B_BAD_ADDRESS		((status_t)0x80001201)
+#define B_CANCELED		((status_t)0x8000000f)
+#define B_BUSY			((status_t)0x8000000e)
+#define B_DEV_INVALID_IOCTL	((status_t)0x8000a000)
+#define B_DEV_NOT_READY		((status_t)0x8000a003)
+#define B_DEV_CRC_ERROR		((status_t)0x8000a00b)
+#define B_DEV_TIMEOUT		((status_t)0x8000a012)
+#define B_DEV_STALLED		((status_t)0x8000a01b)
+
+#define min_c(a, b)	((a) > (b)? (b): (a))
+#define max_c(a, b)	((a) > (b)? (a): (b))
+
+// atomic operations return the previous value
+static inline int32
+atomic_add(int32 *value, int32 addValue)
+{
+	return __atomic_fetch_add(value, addValue, __ATOMIC_SEQ_CST);
+}
+
+static inline int32
+atomic_get(int32 *value)
+{
+	return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+}
+
+static inline void
+atomic_set(int32 *value, int32 newValue)
+{
+	__atomic_store_n(value, newValue, __ATOMIC_SEQ_CST);
+}
+
+#endif // _SUPPORT_DEFS_H
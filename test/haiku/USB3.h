@@ -0,0 +1,108 @@
+/*
+ * $Id$
+ *
+ * Copyright (c) 2011 Takashi TOYOSHIMA <toyoshim@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Host stand-in for the Haiku header, only what the driver uses */
+
+#ifndef _USB_V3_H
+#define _USB_V3_H
+
+#include <KernelExport.h>
+
+typedef uint32 usb_id;
+typedef usb_id usb_device;
+typedef usb_id usb_pipe;
+
+#define B_USB_MODULE_NAME		"bus_managers/usb/v3"
+
+#define USB_REQTYPE_INTERFACE_OUT	0x01
+#define USB_REQTYPE_CLASS		0x20
+#define USB_ENDPOINT_ATTR_INTERRUPT	0x03
+#define USB_ENDPOINT_ADDR_DIR_IN	0x80
+#define USB_FEATURE_ENDPOINT_HALT	0
+
+typedef struct {
+	uint8  length;
+	uint8  descriptor_type;
+	uint8  endpoint_address;
+	uint8  attributes;
+	uint16 max_packet_size;
+	uint8  interval;
+} usb_endpoint_descriptor;
+
+typedef struct {
+	usb_endpoint_descriptor *descr;
+	usb_pipe                 handle;
+} usb_endpoint_info;
+
+typedef struct {
+	void              *descr;
+	usb_id             handle;
+	size_t             endpoint_count;
+	usb_endpoint_info *endpoint;
+} usb_interface_info;
+
+typedef struct {
+	size_t              alt_count;
+	usb_interface_info *alt;
+	usb_interface_info *active;
+} usb_interface_list;
+
+typedef struct {
+	void               *descr;
+	size_t              interface_count;
+	usb_interface_list *interface;
+} usb_configuration_info;
+
+typedef struct {
+	uint8  dev_class;
+	uint8  dev_subclass;
+	uint8  dev_protocol;
+	uint16 vendor;
+	uint16 product;
+} usb_support_descriptor;
+
+typedef void (*usb_callback_func)(void *cookie, status_t status, void *data,
+	size_t actualLength);
+
+typedef struct {
+	status_t (*device_added)(usb_device device, void **cookie);
+	status_t (*device_removed)(void *cookie);
+} usb_notify_hooks;
+
+typedef struct {
+	module_info binfo;
+	status_t (*register_driver)(const char *driverName,
+		const usb_support_descriptor *supportDescriptors,
+		size_t supportDescriptorCount, const char *optionalRepublishDriverName);
+	status_t (*install_notify)(const char *driverName,
+		const usb_notify_hooks *hooks);
+	status_t (*uninstall_notify)(const char *driverName);
+	const usb_configuration_info *(*get_nth_configuration)(usb_device device,
+		uint32 index);
+	status_t (*set_configuration)(usb_device device,
+		const usb_configuration_info *configuration);
+	status_t (*send_request)(usb_device device, uint8 requestType,
+		uint8 request, uint16 value, uint16 index, uint16 length,
+		void *data, size_t *actualLength);
+	status_t (*queue_interrupt)(usb_pipe pipe, void *data, size_t dataLength,
+		usb_callback_func callback, void *callbackCookie);
+	status_t (*cancel_queued_transfers)(usb_pipe pipe);
+	status_t (*clear_feature)(usb_id object, uint16 selector);
+} usb_module_info;
+
+#endif // _USB_V3_H
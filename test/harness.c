@@ -0,0 +1,334 @@
+/*
+ * $Id$
+ *
+ * Copyright (c) 2011 Takashi TOYOSHIMA <toyoshim@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Stress harness of the YUREX driver on the simulated usb stack */
+
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "yurex.h"
+#include "sim.h"
+
+// default settings
+#define MAX_COLUMNS		16	// values of -t or -d
+#define MAX_DEVICES		256	// devices of one run
+#define WORKER_STACK		(256 * 1024)	// worker thread stack size
+static const char *kThreads = "1,16,256,2048";
+static const char *kDevices = "1,8,64";
+static const bigtime_t kDuration = 1000000;	// usec per run
+
+// device slot variables, the storm thread replaces devices under sSlotLock
+typedef struct _slot {
+	sim_device *sim;		// simulated device, NULL while replaced
+	char        bbu[64];		// bbu node pathname
+	char        anime[64];		// animation node pathname
+} slot;
+
+// worker thread variables
+typedef struct _worker {
+	pthread_t thread;		// host thread
+	uint32    seed;			// random seed
+	uint64    ops;			// open, read, write, control and free
+	uint64    gone;			// opens of a replaced device
+} worker;
+
+// global variables
+static pthread_mutex_t sSlotLock = PTHREAD_MUTEX_INITIALIZER;
+static slot   sSlots[MAX_DEVICES];	// devices under test
+static int    sSlotCount;		//   number of slots
+static int32  sStop;			// run is over?
+static uint64 sStorms;			// devices replaced (storm thread)
+static uint64 sBeats;			// beat reports (pump thread)
+
+//
+// harness functions
+//
+
+static void
+harness_plug
+(int index)
+{
+	// called from one thread at a time for a slot
+	sim_device *sim = sim_attach(8);
+
+	pthread_mutex_lock(&sSlotLock);
+	sSlots[index].sim = sim;
+	sim_path(sim, "bbu", sSlots[index].bbu, sizeof(sSlots[index].bbu));
+	sim_path(sim, "animation", sSlots[index].anime,
+		sizeof(sSlots[index].anime));
+	pthread_mutex_unlock(&sSlotLock);
+}
+
+static void
+harness_unplug
+(int index)
+{
+	sim_device *sim;
+
+	pthread_mutex_lock(&sSlotLock);
+	sim = sSlots[index].sim;
+	sSlots[index].sim = NULL;
+	pthread_mutex_unlock(&sSlotLock);
+	if (NULL != sim)
+		sim_detach(sim);
+}
+
+static void *
+harness_storm
+(void *arg)
+{
+	// unplug a device and plug in a new one, as fast as it goes
+	uint32 seed = 1;
+
+	while (0 == atomic_get(&sStop)) {
+		int index = rand_r(&seed) % sSlotCount;
+		harness_unplug(index);
+		harness_plug(index);
+		sStorms++;
+	}
+	return NULL;
+}
+
+static void *
+harness_pump
+(void *arg)
+{
+	// complete interrupt transfers, and beat once in a while
+	uint32 seed = 2;
+
+	while (0 == atomic_get(&sStop)) {
+		if (0 == (rand_r(&seed) % 16)) {
+			int index = rand_r(&seed) % sSlotCount;
+			pthread_mutex_lock(&sSlotLock);
+			if (NULL != sSlots[index].sim) {
+				sim_beat(sSlots[index].sim, 1);
+				sBeats++;
+			}
+			pthread_mutex_unlock(&sSlotLock);
+		}
+		if (0 == sim_pump_all())
+			sched_yield();
+	}
+	return NULL;
+}
+
+static void *
+harness_worker
+(void *arg)
+{
+	// open a node of a random device, use it, and free the cookie; an
+	// animation node may also start a pattern
+	worker *w = (worker *)arg;
+	device_hooks *hooks = find_device("");
+
+	while (0 == atomic_get(&sStop)) {
+		int index = rand_r(&w->seed) % sSlotCount;
+		int anime = (0 == (rand_r(&w->seed) % 8));
+		char path[64];
+		char buf[32];
+		size_t len;
+		void *cookie = NULL;
+		yurex_stats stats;
+
+		pthread_mutex_lock(&sSlotLock);
+		strcpy(path, (0 != anime)? sSlots[index].anime: sSlots[index].bbu);
+		pthread_mutex_unlock(&sSlotLock);
+		if (B_OK != hooks->open(path, 0, &cookie)) {
+			w->gone++;
+			continue;
+		}
+
+		len = sizeof(buf);
+		hooks->read(cookie, 0, buf, &len);
+		if (0 != anime)
+			len = snprintf(buf, sizeof(buf), "%d", rand_r(&w->seed) % 2);
+		else
+			len = snprintf(buf, sizeof(buf), "%u", rand_r(&w->seed) % 1000);
+		hooks->write(cookie, 0, buf, &len);
+		if ((0 != anime) && (0 == (rand_r(&w->seed) % 4))) {
+			// short finite patterns, shared by a few groups
+			yurex_pattern pattern = { 10000, 10000,
+				rand_r(&w->seed) % 3, rand_r(&w->seed) % 3 };
+			hooks->control(cookie, YUREX_SET_PATTERN, &pattern,
+				sizeof(pattern));
+		}
+		hooks->control(cookie, YUREX_GET_STATS, &stats, sizeof(stats));
+		hooks->close(cookie);
+		hooks->free(cookie);
+		w->ops++;
+	}
+	return NULL;
+}
+
+static int
+harness_run
+(int threads, int devices, bigtime_t duration)
+{
+	// returns the number of simulator errors of the run
+	pthread_attr_t attr;
+	pthread_t storm;
+	pthread_t pump;
+	worker *workers;
+	uint64 ops = 0;
+	uint64 gone = 0;
+	int32 errors = sim_errors();
+	bigtime_t start;
+	double sec;
+	int created;
+	int i;
+
+	workers = (worker *)calloc(threads, sizeof(worker));
+	if (NULL == workers) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	sSlotCount = devices;
+	sStorms    = 0;
+	sBeats     = 0;
+	for (i = 0; i < devices; i++)
+		harness_plug(i);
+	atomic_set(&sStop, 0);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, WORKER_STACK);
+	start = system_time();
+	for (created = 0; created < threads; created++) {
+		workers[created].seed = created + 3;
+		if (0 != pthread_create(&workers[created].thread, &attr,
+			harness_worker, &workers[created]))
+			break;
+	}
+	pthread_create(&storm, &attr, harness_storm, NULL);
+	pthread_create(&pump, &attr, harness_pump, NULL);
+	pthread_attr_destroy(&attr);
+
+	snooze(duration);
+	atomic_set(&sStop, 1);
+	for (i = 0; i < created; i++) {
+		pthread_join(workers[i].thread, NULL);
+		ops  += workers[i].ops;
+		gone += workers[i].gone;
+	}
+	pthread_join(storm, NULL);
+	pthread_join(pump, NULL);
+	sec = (double)(system_time() - start) / 1000000.0;
+
+	for (i = 0; i < devices; i++)
+		harness_unplug(i);
+	free(workers);
+
+	printf("%7d %7d %10.0f %10.0f %10.0f %10.0f\n", created, devices,
+		(double)ops / sec, (double)gone / sec, (double)sStorms / sec,
+		(double)sBeats / sec);
+	fflush(stdout);
+	if (created != threads)
+		fprintf(stderr, "only %d of %d threads created\n", created, threads);
+	return sim_errors() - errors;
+}
+
+static int
+harness_list
+(const char *arg, int *values, int max)
+{
+	// parse a comma separated list of positive numbers
+	int count = 0;
+
+	while ('\0' != *arg) {
+		char *end;
+		long value = strtol(arg, &end, 10);
+		if ((end == arg) || (value <= 0) || (count == max))
+			return 0;
+		values[count++] = (int)value;
+		arg = end;
+		if (',' == *arg)
+			arg++;
+		else if ('\0' != *arg)
+			return 0;
+	}
+	return count;
+}
+
+static void
+usage
+(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-t threads,...] [-d devices,...] [-s msec per run]\n",
+		name);
+	exit(1);
+}
+
+int
+main
+(int argc, char **argv)
+{
+	int threads[MAX_COLUMNS];
+	int devices[MAX_COLUMNS];
+	int thread_count;
+	int device_count;
+	const char *thread_arg = kThreads;
+	const char *device_arg = kDevices;
+	bigtime_t duration = kDuration;
+	int errors = 0;
+	int opt;
+	int i, j;
+
+	while (-1 != (opt = getopt(argc, argv, "t:d:s:"))) {
+		switch (opt) {
+		case 't':
+			thread_arg = optarg;
+			break;
+		case 'd':
+			device_arg = optarg;
+			break;
+		case 's':
+			duration = atoi(optarg) * 1000LL;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	thread_count = harness_list(thread_arg, threads, MAX_COLUMNS);
+	device_count = harness_list(device_arg, devices, MAX_COLUMNS);
+	if ((0 == thread_count) || (0 == device_count) || (duration <= 0))
+		usage(argv[0]);
+	for (i = 0; i < device_count; i++)
+		if (MAX_DEVICES < devices[i])
+			usage(argv[0]);
+
+	if (B_OK != init_driver()) {
+		fprintf(stderr, "init_driver failed\n");
+		return 1;
+	}
+	printf("%7s %7s %10s %10s %10s %10s\n",
+		"THREADS", "DEVICES", "OPS/s", "GONE/s", "REPLUG/s", "BEATS/s");
+	for (i = 0; i < device_count; i++)
+		for (j = 0; j < thread_count; j++)
+			errors += harness_run(threads[j], devices[i], duration);
+	uninit_driver();
+
+	// every device instance has been freed, and nothing is left running
+	if ((0 != errors) || (0 != sim_threads()) || (0 != sim_sems()) ||
+		(0 != sim_errors())) {
+		printf("FAIL: errors=%d threads=%" B_PRId32 " sems=%" B_PRId32 "\n",
+			errors, sim_threads(), sim_sems());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,1316 @@
+/*
+ * $Id$
+ *
+ * Copyright (c) 2011 Takashi TOYOSHIMA <toyoshim@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Simulated kernel and usb stack for host tests of the YUREX driver */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#include <OS.h>
+#include <KernelExport.h>
+#include <USB3.h>
+
+#include "sim.h"
+
+#define SIM_MAX_SEMS		8192
+#define SIM_MAX_PORTS		256
+#define SIM_MAX_THREADS		64
+#define SIM_MAX_DEVICES		1024
+#define SIM_PORT_MESSAGE	256
+#define SIM_QUEUE		256
+#define SIM_TRANSFER		64
+#define SIM_BBU_MASK		0xffffffffffLL
+
+// semaphore variables
+typedef struct _sim_sem {
+	int             used;		// allocated?
+	int32           gen;		// generation, part of the ID
+	int32           count;		// semaphore count
+	pthread_cond_t  cond;		// signaled on release or delete
+} sim_sem;
+
+// port variables
+typedef struct _sim_message {
+	int32  code;			// message code
+	size_t size;			// message size
+	uint8  data[SIM_PORT_MESSAGE];	// message body
+} sim_message;
+typedef struct _sim_port {
+	int             used;		// allocated?
+	int32           gen;		// generation, part of the ID
+	int32           capacity;	// queue capacity
+	int32           head;		// oldest message
+	int32           count;		// queued messages
+	sim_message    *queue;		// message ring
+	pthread_cond_t  cond;		// signaled on write or delete
+} sim_port;
+
+// kernel thread variables
+typedef struct _sim_thread {
+	int             used;		// allocated?
+	int             resumed;	// resume_thread called?
+	pthread_t       thread;		// host thread
+	thread_func     func;		// thread function
+	void           *arg;		//   and its argument
+	pthread_cond_t  cond;		// signaled on resume
+} sim_thread;
+
+// interrupt transfer queued on the device side
+typedef struct _sim_transfer {
+	bigtime_t due;			// not completed before
+	status_t status;		// completion status
+	size_t   length;		// transfer length
+	uint8    data[SIM_TRANSFER];	// transfer data
+} sim_transfer;
+
+// usb device variables
+struct _sim_device {
+	int                     used;		// allocated?
+	usb_id                  id;		// usb device and pipe ID
+	int                     present;	// plugged in?
+	int                     attached;	// driver cookie valid?
+	void                   *cookie;		//   driver cookie
+	usb_endpoint_descriptor epd;		// interrupt in endpoint
+	usb_endpoint_info       ep;
+	usb_interface_info      intf;
+	usb_interface_list      list;
+	usb_configuration_info  conf;
+	uint64                  counter;	// BBU counter
+	uint8                   mode;		// last mode request
+	uint32                  drop_acks;	// write ACKs to lose
+	uint32                  ignore_writes;	// writes to ACK but not take
+	uint32                  requests[256];	// requests by command
+	uint32                  queue_calls;	// queue_interrupt calls
+	bigtime_t               stall;		// control transfer time
+	uint32                  fail_queues;	// queue_interrupt calls to fail
+	uint32                  fail_requests;	// control transfers to lose
+	bigtime_t               ack_delay;	// write ACK delivery delay
+	int                     remove_next;	// unplug in the next completion?
+	usb_callback_func       callback;	// queued interrupt transfer
+	void                   *callback_cookie;
+	uint8                  *data;
+	size_t                  length;
+	int                     queued;		//   transfer is queued?
+	int                     busy;		// callbacks running
+	sim_transfer            queue[SIM_QUEUE];	// pending transfers
+	int                     head;
+	int                     count;
+};
+
+// global variables
+static pthread_mutex_t sLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  sIdle;
+static pthread_once_t  sOnce = PTHREAD_ONCE_INIT;
+static sim_sem         sSems[SIM_MAX_SEMS];
+static sim_port        sPorts[SIM_MAX_PORTS];
+static sim_thread      sThreads[SIM_MAX_THREADS];
+static sim_device      sDevices[SIM_MAX_DEVICES];
+static int32           sSemNext;
+static int32           sModuleRefs;
+static int             sFailGetModule;
+static int32           sErrors;
+static bigtime_t       sRequestDelay;
+static const usb_notify_hooks *sHooks;
+
+static void sim_init(void);
+static void sim_error(const char *format, ...);
+static void sim_deadline(bigtime_t deadline, struct timespec *ts);
+static sim_sem *sim_find_sem(sem_id id);
+static sim_port *sim_find_port(port_id id);
+static sim_device *sim_find_device(usb_id id);
+static sim_transfer *sim_queue(sim_device *dev, const uint8 *data,
+	size_t length, status_t status);
+static void sim_complete(sim_device *dev, status_t status, size_t length);
+
+//
+// sim functions
+//
+
+void
+sim_init
+(void)
+{
+	pthread_condattr_t attr;
+	int i;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&sIdle, &attr);
+	for (i = 0; i < SIM_MAX_SEMS; i++)
+		pthread_cond_init(&sSems[i].cond, &attr);
+	for (i = 0; i < SIM_MAX_PORTS; i++)
+		pthread_cond_init(&sPorts[i].cond, &attr);
+	for (i = 0; i < SIM_MAX_THREADS; i++)
+		pthread_cond_init(&sThreads[i].cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+void
+sim_error
+(const char *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	fprintf(stderr, "sim: ");
+	vfprintf(stderr, format, args);
+	va_end(args);
+	__atomic_fetch_add(&sErrors, 1, __ATOMIC_SEQ_CST);
+}
+
+void
+sim_deadline
+(bigtime_t deadline, struct timespec *ts)
+{
+	ts->tv_sec  = deadline / 1000000;
+	ts->tv_nsec = (deadline % 1000000) * 1000;
+}
+
+sim_sem *
+sim_find_sem
+(sem_id id)
+{
+	// called with sLock held
+	sim_sem *sem;
+
+	if ((id <= 0) || ((id & 0xffff) >= SIM_MAX_SEMS))
+		return NULL;
+	sem = &sSems[id & 0xffff];
+	if ((0 == sem->used) || (sem->gen != (id >> 16)))
+		return NULL;
+	return sem;
+}
+
+sim_port *
+sim_find_port
+(port_id id)
+{
+	// called with sLock held
+	sim_port *port;
+
+	if ((id <= 0) || ((id & 0xffff) >= SIM_MAX_PORTS))
+		return NULL;
+	port = &sPorts[id & 0xffff];
+	if ((0 == port->used) || (port->gen != (id >> 16)))
+		return NULL;
+	return port;
+}
+
+sim_device *
+sim_find_device
+(usb_id id)
+{
+	// called with sLock held
+	sim_device *dev;
+
+	if ((id & 0x3ff) >= SIM_MAX_DEVICES)
+		return NULL;
+	dev = &sDevices[id & 0x3ff];
+	if ((0 == dev->used) || (dev->id != id))
+		return NULL;
+	return dev;
+}
+
+sim_transfer *
+sim_queue
+(sim_device *dev, const uint8 *data, size_t length, status_t status)
+{
+	// called with sLock held
+	sim_transfer *transfer;
+
+	if (SIM_QUEUE == dev->count)
+		return NULL;	// reports nobody polls for are lost
+	transfer = &dev->queue[(dev->head + dev->count++) % SIM_QUEUE];
+	transfer->due    = 0;
+	transfer->status = status;
+	transfer->length = min_c(length, SIM_TRANSFER);
+	if (0 != transfer->length)
+		memcpy(transfer->data, data, transfer->length);
+	return transfer;
+}
+
+void
+sim_complete
+(sim_device *dev, status_t status, size_t length)
+{
+	// called with sLock held, returns with it held
+	usb_callback_func callback = dev->callback;
+	void *cookie = dev->callback_cookie;
+	int remove = (B_CANCELED != status) && (0 != dev->remove_next) &&
+		(0 != dev->attached) && (NULL != sHooks);
+	const usb_notify_hooks *hooks = sHooks;
+	void *driver = dev->cookie;
+
+	dev->queued = 0;
+	dev->busy++;
+	if (0 != remove) {
+		// the device goes away while its completion is delivered
+		dev->remove_next = 0;
+		dev->present     = 0;
+		dev->attached    = 0;
+	}
+	pthread_mutex_unlock(&sLock);
+	if (0 != remove)
+		hooks->device_removed(driver);
+	callback(cookie, status, dev->data, length);
+	pthread_mutex_lock(&sLock);
+	dev->busy--;
+	pthread_cond_broadcast(&sIdle);
+}
+
+//
+// test interface
+//
+
+sim_device *
+sim_attach
+(uint16 maxPacketSize)
+{
+	static int32 gen = 0;
+	const usb_notify_hooks *hooks;
+	sim_device *dev = NULL;
+	void *cookie = NULL;
+	int i;
+
+	pthread_once(&sOnce, sim_init);
+	pthread_mutex_lock(&sLock);
+	for (i = 0; i < SIM_MAX_DEVICES; i++) {
+		if (0 == sDevices[i].used) {
+			dev = &sDevices[i];
+			break;
+		}
+	}
+	if (NULL == dev) {
+		pthread_mutex_unlock(&sLock);
+		sim_error("too many devices\n");
+		return NULL;
+	}
+	memset(dev, 0, sizeof(sim_device));
+	gen = (gen % 0x3fff) + 1;
+	dev->used    = 1;
+	dev->present = 1;
+	dev->id      = (gen << 10) | i;
+	dev->epd.length           = 7;
+	dev->epd.descriptor_type  = 0x05;
+	dev->epd.endpoint_address = USB_ENDPOINT_ADDR_DIR_IN | 1;
+	dev->epd.attributes       = USB_ENDPOINT_ATTR_INTERRUPT;
+	dev->epd.max_packet_size  = maxPacketSize;
+	dev->epd.interval         = 10;
+	dev->ep.descr             = &dev->epd;
+	dev->ep.handle            = dev->id;
+	dev->intf.handle          = dev->id;
+	dev->intf.endpoint_count  = 1;
+	dev->intf.endpoint        = &dev->ep;
+	dev->list.alt_count       = 1;
+	dev->list.alt             = &dev->intf;
+	dev->list.active          = &dev->intf;
+	dev->conf.interface_count = 1;
+	dev->conf.interface       = &dev->list;
+	hooks = sHooks;
+	pthread_mutex_unlock(&sLock);
+
+	if ((NULL != hooks) && (B_OK == hooks->device_added(dev->id, &cookie))) {
+		pthread_mutex_lock(&sLock);
+		dev->attached = 1;
+		dev->cookie   = cookie;
+		pthread_mutex_unlock(&sLock);
+	}
+	return dev;
+}
+
+void
+sim_detach
+(sim_device *dev)
+{
+	const usb_notify_hooks *hooks;
+	void *cookie;
+	int attached;
+
+	pthread_mutex_lock(&sLock);
+	dev->present  = 0;
+	attached      = dev->attached;
+	cookie        = dev->cookie;
+	dev->attached = 0;
+	hooks         = sHooks;
+	pthread_mutex_unlock(&sLock);
+
+	if ((0 != attached) && (NULL != hooks))
+		hooks->device_removed(cookie);
+
+	// the slot is reused once no callback runs on it
+	pthread_mutex_lock(&sLock);
+	while (0 != dev->busy)
+		pthread_cond_wait(&sIdle, &sLock);
+	dev->used = 0;
+	pthread_mutex_unlock(&sLock);
+}
+
+void
+sim_path
+(sim_device *dev, const char *node, char *path, size_t size)
+{
+	snprintf(path, size, "misc/yurex/%08" B_PRIu32 "/%s", dev->id, node);
+}
+
+void
+sim_beat
+(sim_device *dev, uint32 beats)
+{
+	uint8 report[SIM_REPORT_SIZE];
+
+	pthread_mutex_lock(&sLock);
+	dev->counter = (dev->counter + beats) & SIM_BBU_MASK;
+	sim_report(report, SIM_CMD_VALUE, dev->counter);
+	sim_queue(dev, report, sizeof(report), B_OK);
+	pthread_mutex_unlock(&sLock);
+}
+
+void
+sim_batch
+(sim_device *dev, uint32 beats)
+{
+	// the device counts up beat by beat, and packs the value reports into
+	// transfers of up to its max packet size
+	uint8 transfer[SIM_TRANSFER];
+	size_t size;
+	size_t length = 0;
+
+	pthread_mutex_lock(&sLock);
+	size = min_c(dev->epd.max_packet_size, SIM_TRANSFER);
+	while (0 != beats--) {
+		dev->counter = (dev->counter + 1) & SIM_BBU_MASK;
+		sim_report(&transfer[length], SIM_CMD_VALUE, dev->counter);
+		length += SIM_REPORT_SIZE;
+		if ((0 == beats) || (length + SIM_REPORT_SIZE > size)) {
+			sim_queue(dev, transfer, length, B_OK);
+			length = 0;
+		}
+	}
+	pthread_mutex_unlock(&sLock);
+}
+
+void
+sim_drop_acks
+(sim_device *dev, uint32 count)
+{
+	pthread_mutex_lock(&sLock);
+	dev->drop_acks += count;
+	pthread_mutex_unlock(&sLock);
+}
+
+void
+sim_ignore_writes
+(sim_device *dev, uint32 count)
+{
+	pthread_mutex_lock(&sLock);
+	dev->ignore_writes += count;
+	pthread_mutex_unlock(&sLock);
+}
+
+void
+sim_report
+(uint8 *report, uint8 command, uint64 bbu)
+{
+	memset(report, 0xff, SIM_REPORT_SIZE);
+	report[0] = command;
+	if (SIM_CMD_ACK == command) {
+		report[1] = (uint8)bbu;
+		report[2] = SIM_CMD_EOF;
+		return;
+	}
+	report[1] = (bbu >> 32) & 0xff;
+	report[2] = (bbu >> 24) & 0xff;
+	report[3] = (bbu >> 16) & 0xff;
+	report[4] = (bbu >>  8) & 0xff;
+	report[5] = (bbu >>  0) & 0xff;
+	report[6] = SIM_CMD_EOF;
+}
+
+void
+sim_push
+(sim_device *dev, const uint8 *data, size_t length, status_t status)
+{
+	pthread_mutex_lock(&sLock);
+	sim_queue(dev, data, length, status);
+	pthread_mutex_unlock(&sLock);
+}
+
+uint64
+sim_counter
+(sim_device *dev)
+{
+	uint64 counter;
+
+	pthread_mutex_lock(&sLock);
+	counter = dev->counter;
+	pthread_mutex_unlock(&sLock);
+	return counter;
+}
+
+uint8
+sim_mode
+(sim_device *dev)
+{
+	uint8 mode;
+
+	pthread_mutex_lock(&sLock);
+	mode = dev->mode;
+	pthread_mutex_unlock(&sLock);
+	return mode;
+}
+
+uint32
+sim_requests
+(sim_device *dev, uint8 command)
+{
+	uint32 requests;
+
+	pthread_mutex_lock(&sLock);
+	requests = dev->requests[command];
+	pthread_mutex_unlock(&sLock);
+	return requests;
+}
+
+uint32
+sim_queue_calls
+(sim_device *dev)
+{
+	uint32 calls;
+
+	pthread_mutex_lock(&sLock);
+	calls = dev->queue_calls;
+	pthread_mutex_unlock(&sLock);
+	return calls;
+}
+
+int
+sim_pump
+(sim_device *dev)
+{
+	// complete the queued interrupt transfer with the next pending one
+	sim_transfer transfer;
+
+	pthread_mutex_lock(&sLock);
+	if ((0 == dev->used) || (0 == dev->present) || (0 == dev->queued) ||
+		(0 == dev->count) || (dev->queue[dev->head].due > system_time())) {
+		pthread_mutex_unlock(&sLock);
+		return 0;
+	}
+	transfer = dev->queue[dev->head];
+	dev->head = (dev->head + 1) % SIM_QUEUE;
+	dev->count--;
+	transfer.length = min_c(transfer.length, dev->length);
+	memcpy(dev->data, transfer.data, transfer.length);
+	sim_complete(dev, transfer.status, transfer.length);
+	pthread_mutex_unlock(&sLock);
+	return 1;
+}
+
+int
+sim_pump_all
+(void)
+{
+	int pumped = 0;
+	int i;
+
+	for (i = 0; i < SIM_MAX_DEVICES; i++)
+		pumped += sim_pump(&sDevices[i]);
+	return pumped;
+}
+
+void
+sim_settle
+(bigtime_t quiet)
+{
+	// pump until nothing happened for the quiet period
+	bigtime_t start = system_time();
+	bigtime_t last = start;
+
+	while (system_time() - last < quiet) {
+		if (0 != sim_pump_all())
+			last = system_time();
+		else
+			snooze(1000);
+		if (system_time() - start > 5000000) {
+			sim_error("settle timed out\n");
+			break;
+		}
+	}
+}
+
+void
+sim_fail_queues
+(sim_device *dev, uint32 count)
+{
+	pthread_mutex_lock(&sLock);
+	dev->fail_queues += count;
+	pthread_mutex_unlock(&sLock);
+}
+
+void
+sim_fail_requests
+(sim_device *dev, uint32 count)
+{
+	pthread_mutex_lock(&sLock);
+	dev->fail_requests += count;
+	pthread_mutex_unlock(&sLock);
+}
+
+void
+sim_delay_acks
+(sim_device *dev, bigtime_t delay)
+{
+	pthread_mutex_lock(&sLock);
+	dev->ack_delay = delay;
+	pthread_mutex_unlock(&sLock);
+}
+
+void
+sim_remove_in_callback
+(sim_device *dev)
+{
+	pthread_mutex_lock(&sLock);
+	dev->remove_next = 1;
+	pthread_mutex_unlock(&sLock);
+}
+
+void
+sim_stall
+(sim_device *dev, bigtime_t delay)
+{
+	pthread_mutex_lock(&sLock);
+	dev->stall = delay;
+	pthread_mutex_unlock(&sLock);
+}
+
+void
+sim_request_delay
+(bigtime_t delay)
+{
+	__atomic_store_n(&sRequestDelay, delay, __ATOMIC_SEQ_CST);
+}
+
+void
+sim_fail_get_module
+(int fail)
+{
+	sFailGetModule = fail;
+}
+
+int32
+sim_threads
+(void)
+{
+	int32 threads = 0;
+	int i;
+
+	pthread_mutex_lock(&sLock);
+	for (i = 0; i < SIM_MAX_THREADS; i++)
+		threads += sThreads[i].used;
+	pthread_mutex_unlock(&sLock);
+	return threads;
+}
+
+int32
+sim_sems
+(void)
+{
+	int32 sems = 0;
+	int i;
+
+	pthread_mutex_lock(&sLock);
+	for (i = 0; i < SIM_MAX_SEMS; i++)
+		sems += sSems[i].used;
+	pthread_mutex_unlock(&sLock);
+	return sems;
+}
+
+int32
+sim_errors
+(void)
+{
+	return __atomic_load_n(&sErrors, __ATOMIC_SEQ_CST);
+}
+
+//
+// kernel functions
+//
+
+void
+sim_dprintf
+(const char *format, ...)
+{
+	va_list args;
+
+	if (NULL == getenv("YUREX_SIM_TRACE"))
+		return;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+}
+
+bigtime_t
+system_time
+(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (bigtime_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+status_t
+snooze
+(bigtime_t amount)
+{
+	struct timespec ts;
+
+	if (amount <= 0)
+		return B_OK;
+	ts.tv_sec  = amount / 1000000;
+	ts.tv_nsec = (amount % 1000000) * 1000;
+	while ((0 != nanosleep(&ts, &ts)) && (EINTR == errno))
+		;
+	return B_OK;
+}
+
+status_t
+snooze_until
+(bigtime_t time, int timeBase)
+{
+	return snooze(time - system_time());
+}
+
+status_t
+user_memcpy
+(void *to, const void *from, size_t size)
+{
+	if ((NULL == to) || (NULL == from))
+		return B_BAD_ADDRESS;
+	memcpy(to, from, size);
+	return B_OK;
+}
+
+sem_id
+create_sem
+(int32 count, const char *name)
+{
+	sim_sem *sem = NULL;
+	sem_id id;
+	int i;
+
+	pthread_once(&sOnce, sim_init);
+	pthread_mutex_lock(&sLock);
+	for (i = 0; i < SIM_MAX_SEMS; i++) {
+		int slot = (sSemNext + i) % SIM_MAX_SEMS;
+		if ((0 != slot) && (0 == sSems[slot].used)) {
+			sem = &sSems[slot];
+			sSemNext = slot + 1;
+			break;
+		}
+	}
+	if (NULL == sem) {
+		pthread_mutex_unlock(&sLock);
+		return B_NO_MORE_SEMS;
+	}
+	sem->used  = 1;
+	sem->gen   = (sem->gen % 0x7fff) + 1;
+	sem->count = count;
+	id = (sem->gen << 16) | (int32)(sem - sSems);
+	pthread_mutex_unlock(&sLock);
+	return id;
+}
+
+status_t
+delete_sem
+(sem_id id)
+{
+	sim_sem *sem;
+
+	pthread_mutex_lock(&sLock);
+	sem = sim_find_sem(id);
+	if (NULL == sem) {
+		pthread_mutex_unlock(&sLock);
+		return B_BAD_SEM_ID;
+	}
+	sem->used = 0;
+	pthread_cond_broadcast(&sem->cond);
+	pthread_mutex_unlock(&sLock);
+	return B_OK;
+}
+
+status_t
+acquire_sem
+(sem_id id)
+{
+	return acquire_sem_etc(id, 1, 0, 0);
+}
+
+status_t
+acquire_sem_etc
+(sem_id id, int32 count, uint32 flags, bigtime_t timeout)
+{
+	sim_sem *sem;
+	bigtime_t deadline = B_INFINITE_TIMEOUT;
+	struct timespec ts;
+
+	if (0 != (flags & B_ABSOLUTE_TIMEOUT))
+		deadline = timeout;
+	else if ((0 != (flags & B_RELATIVE_TIMEOUT)) &&
+		(B_INFINITE_TIMEOUT != timeout))
+		deadline = system_time() + timeout;
+	sim_deadline(deadline, &ts);
+
+	pthread_mutex_lock(&sLock);
+	sem = sim_find_sem(id);
+	if (NULL == sem) {
+		pthread_mutex_unlock(&sLock);
+		return B_BAD_SEM_ID;
+	}
+	while (sem->count < count) {
+		int result;
+		if (B_INFINITE_TIMEOUT == deadline)
+			result = pthread_cond_wait(&sem->cond, &sLock);
+		else if (deadline <= system_time())
+			result = ETIMEDOUT;
+		else
+			result = pthread_cond_timedwait(&sem->cond, &sLock, &ts);
+		if (sem != sim_find_sem(id)) {
+			pthread_mutex_unlock(&sLock);
+			return B_BAD_SEM_ID;
+		}
+		if ((ETIMEDOUT == result) && (sem->count < count)) {
+			pthread_mutex_unlock(&sLock);
+			return ((0 != (flags & B_RELATIVE_TIMEOUT)) && (0 == timeout))?
+				B_WOULD_BLOCK: B_TIMED_OUT;
+		}
+	}
+	sem->count -= count;
+	pthread_mutex_unlock(&sLock);
+	return B_OK;
+}
+
+status_t
+release_sem
+(sem_id id)
+{
+	return release_sem_etc(id, 1, 0);
+}
+
+status_t
+release_sem_etc
+(sem_id id, int32 count, uint32 flags)
+{
+	sim_sem *sem;
+
+	pthread_mutex_lock(&sLock);
+	sem = sim_find_sem(id);
+	if (NULL == sem) {
+		pthread_mutex_unlock(&sLock);
+		return B_BAD_SEM_ID;
+	}
+	sem->count += count;
+	pthread_cond_broadcast(&sem->cond);
+	pthread_mutex_unlock(&sLock);
+	return B_OK;
+}
+
+port_id
+create_port
+(int32 capacity, const char *name)
+{
+	sim_port *port = NULL;
+	port_id id;
+	int i;
+
+	pthread_once(&sOnce, sim_init);
+	if (capacity <= 0)
+		return B_BAD_VALUE;
+	pthread_mutex_lock(&sLock);
+	for (i = 1; i < SIM_MAX_PORTS; i++) {
+		if (0 == sPorts[i].used) {
+			port = &sPorts[i];
+			break;
+		}
+	}
+	if (NULL == port) {
+		pthread_mutex_unlock(&sLock);
+		return B_NO_MORE_PORTS;
+	}
+	port->queue = (sim_message *)malloc(sizeof(sim_message) * capacity);
+	if (NULL == port->queue) {
+		pthread_mutex_unlock(&sLock);
+		return B_NO_MEMORY;
+	}
+	port->used     = 1;
+	port->gen      = (port->gen % 0x7fff) + 1;
+	port->capacity = capacity;
+	port->head     = 0;
+	port->count    = 0;
+	id = (port->gen << 16) | i;
+	pthread_mutex_unlock(&sLock);
+	return id;
+}
+
+status_t
+delete_port
+(port_id id)
+{
+	sim_port *port;
+
+	pthread_mutex_lock(&sLock);
+	port = sim_find_port(id);
+	if (NULL == port) {
+		pthread_mutex_unlock(&sLock);
+		return B_BAD_PORT_ID;
+	}
+	port->used = 0;
+	free(port->queue);
+	port->queue = NULL;
+	pthread_cond_broadcast(&port->cond);
+	pthread_mutex_unlock(&sLock);
+	return B_OK;
+}
+
+ssize_t
+port_count
+(port_id id)
+{
+	sim_port *port;
+	ssize_t count;
+
+	pthread_mutex_lock(&sLock);
+	port = sim_find_port(id);
+	count = (NULL != port)? port->count: B_BAD_PORT_ID;
+	pthread_mutex_unlock(&sLock);
+	return count;
+}
+
+status_t
+write_port_etc
+(port_id id, int32 code, const void *buffer, size_t bufferSize,
+	uint32 flags, bigtime_t timeout)
+{
+	sim_port *port;
+	sim_message *message;
+
+	if (SIM_PORT_MESSAGE < bufferSize)
+		return B_BAD_VALUE;
+	pthread_mutex_lock(&sLock);
+	port = sim_find_port(id);
+	if (NULL == port) {
+		pthread_mutex_unlock(&sLock);
+		return B_BAD_PORT_ID;
+	}
+	while (port->count == port->capacity) {
+		if ((0 != (flags & B_RELATIVE_TIMEOUT)) && (0 == timeout)) {
+			pthread_mutex_unlock(&sLock);
+			return B_WOULD_BLOCK;
+		}
+		pthread_cond_wait(&port->cond, &sLock);
+		if (port != sim_find_port(id)) {
+			pthread_mutex_unlock(&sLock);
+			return B_BAD_PORT_ID;
+		}
+	}
+	message = &port->queue[(port->head + port->count++) % port->capacity];
+	message->code = code;
+	message->size = bufferSize;
+	memcpy(message->data, buffer, bufferSize);
+	pthread_cond_broadcast(&port->cond);
+	pthread_mutex_unlock(&sLock);
+	return B_OK;
+}
+
+ssize_t
+read_port_etc
+(port_id id, int32 *code, void *buffer, size_t bufferSize, uint32 flags,
+	bigtime_t timeout)
+{
+	sim_port *port;
+	sim_message *message;
+	bigtime_t deadline = B_INFINITE_TIMEOUT;
+	struct timespec ts;
+	size_t size;
+
+	if (0 != (flags & B_ABSOLUTE_TIMEOUT))
+		deadline = timeout;
+	else if ((0 != (flags & B_RELATIVE_TIMEOUT)) &&
+		(B_INFINITE_TIMEOUT != timeout))
+		deadline = system_time() + timeout;
+	sim_deadline(deadline, &ts);
+
+	pthread_mutex_lock(&sLock);
+	port = sim_find_port(id);
+	if (NULL == port) {
+		pthread_mutex_unlock(&sLock);
+		return B_BAD_PORT_ID;
+	}
+	while (0 == port->count) {
+		int result;
+		if (B_INFINITE_TIMEOUT == deadline)
+			result = pthread_cond_wait(&port->cond, &sLock);
+		else if (deadline <= system_time())
+			result = ETIMEDOUT;
+		else
+			result = pthread_cond_timedwait(&port->cond, &sLock, &ts);
+		if (port != sim_find_port(id)) {
+			pthread_mutex_unlock(&sLock);
+			return B_BAD_PORT_ID;
+		}
+		if ((ETIMEDOUT == result) && (0 == port->count)) {
+			pthread_mutex_unlock(&sLock);
+			return ((0 != (flags & B_RELATIVE_TIMEOUT)) && (0 == timeout))?
+				B_WOULD_BLOCK: B_TIMED_OUT;
+		}
+	}
+	message = &port->queue[port->head];
+	port->head = (port->head + 1) % port->capacity;
+	port->count--;
+	*code = message->code;
+	size = min_c(message->size, bufferSize);
+	memcpy(buffer, message->data, size);
+	pthread_cond_broadcast(&port->cond);
+	pthread_mutex_unlock(&sLock);
+	return size;
+}
+
+static void *
+sim_thread_entry
+(void *arg)
+{
+	sim_thread *thread = (sim_thread *)arg;
+
+	pthread_mutex_lock(&sLock);
+	while (0 == thread->resumed)
+		pthread_cond_wait(&thread->cond, &sLock);
+	pthread_mutex_unlock(&sLock);
+	return (void *)(intptr_t)thread->func(thread->arg);
+}
+
+thread_id
+spawn_kernel_thread
+(thread_func function, const char *name, int32 priority, void *arg)
+{
+	sim_thread *thread = NULL;
+	int i;
+
+	pthread_once(&sOnce, sim_init);
+	pthread_mutex_lock(&sLock);
+	for (i = 0; i < SIM_MAX_THREADS; i++) {
+		if (0 == sThreads[i].used) {
+			thread = &sThreads[i];
+			break;
+		}
+	}
+	if (NULL == thread) {
+		pthread_mutex_unlock(&sLock);
+		return B_NO_MORE_THREADS;
+	}
+	thread->used    = 1;
+	thread->resumed = 0;
+	thread->func    = function;
+	thread->arg     = arg;
+	if (0 != pthread_create(&thread->thread, NULL, sim_thread_entry, thread)) {
+		thread->used = 0;
+		pthread_mutex_unlock(&sLock);
+		return B_NO_MORE_THREADS;
+	}
+	pthread_mutex_unlock(&sLock);
+	return i + 1;
+}
+
+status_t
+resume_thread
+(thread_id id)
+{
+	sim_thread *thread;
+
+	if ((id <= 0) || (id > SIM_MAX_THREADS))
+		return B_BAD_THREAD_ID;
+	thread = &sThreads[id - 1];
+	pthread_mutex_lock(&sLock);
+	if (0 == thread->used) {
+		pthread_mutex_unlock(&sLock);
+		return B_BAD_THREAD_ID;
+	}
+	thread->resumed = 1;
+	pthread_cond_broadcast(&thread->cond);
+	pthread_mutex_unlock(&sLock);
+	return B_OK;
+}
+
+status_t
+wait_for_thread
+(thread_id id, status_t *returnValue)
+{
+	sim_thread *thread;
+	void *result;
+
+	if (B_OK != resume_thread(id))
+		return B_BAD_THREAD_ID;
+	thread = &sThreads[id - 1];
+	pthread_join(thread->thread, &result);
+	pthread_mutex_lock(&sLock);
+	thread->used = 0;
+	pthread_mutex_unlock(&sLock);
+	if (NULL != returnValue)
+		*returnValue = (status_t)(intptr_t)result;
+	return B_OK;
+}
+
+//
+// usb module functions
+//
+
+static int
+sim_usb_check
+(const char *call)
+{
+	if (0 < __atomic_load_n(&sModuleRefs, __ATOMIC_SEQ_CST))
+		return 1;
+	sim_error("%s called without the usb module\n", call);
+	return 0;
+}
+
+static status_t
+sim_register_driver
+(const char *driverName, const usb_support_descriptor *supportDescriptors,
+	size_t supportDescriptorCount, const char *optionalRepublishDriverName)
+{
+	sim_usb_check("register_driver");
+	return B_OK;
+}
+
+static status_t
+sim_install_notify
+(const char *driverName, const usb_notify_hooks *hooks)
+{
+	sim_usb_check("install_notify");
+	pthread_mutex_lock(&sLock);
+	sHooks = hooks;
+	pthread_mutex_unlock(&sLock);
+	return B_OK;
+}
+
+static status_t
+sim_uninstall_notify
+(const char *driverName)
+{
+	int i;
+
+	sim_usb_check("uninstall_notify");
+	pthread_mutex_lock(&sLock);
+	for (i = 0; i < SIM_MAX_DEVICES; i++) {
+		sim_device *dev = &sDevices[i];
+		if ((0 == dev->used) || (0 == dev->attached))
+			continue;
+		dev->attached = 0;
+		pthread_mutex_unlock(&sLock);
+		sHooks->device_removed(dev->cookie);
+		pthread_mutex_lock(&sLock);
+	}
+	sHooks = NULL;
+	pthread_mutex_unlock(&sLock);
+	return B_OK;
+}
+
+static const usb_configuration_info *
+sim_get_nth_configuration
+(usb_device device, uint32 index)
+{
+	const usb_configuration_info *conf = NULL;
+	sim_device *dev;
+
+	sim_usb_check("get_nth_configuration");
+	pthread_mutex_lock(&sLock);
+	dev = sim_find_device(device);
+	if ((NULL != dev) && (0 != dev->present) && (0 == index))
+		conf = &dev->conf;
+	pthread_mutex_unlock(&sLock);
+	return conf;
+}
+
+static status_t
+sim_set_configuration
+(usb_device device, const usb_configuration_info *configuration)
+{
+	sim_usb_check("set_configuration");
+	return B_OK;
+}
+
+static status_t
+sim_send_request
+(usb_device device, uint8 requestType, uint8 request, uint16 value,
+	uint16 index, uint16 length, void *data, size_t *actualLength)
+{
+	const uint8 *req = (const uint8 *)data;
+	uint8 report[SIM_REPORT_SIZE];
+	sim_transfer *transfer;
+	sim_device *dev;
+	bigtime_t delay = __atomic_load_n(&sRequestDelay, __ATOMIC_SEQ_CST);
+	bigtime_t stall;
+
+	sim_usb_check("send_request");
+	pthread_mutex_lock(&sLock);
+	dev = sim_find_device(device);
+	stall = (NULL != dev)? dev->stall: 0;
+	pthread_mutex_unlock(&sLock);
+	if (0 != stall)
+		snooze(stall);
+	else if (0 != delay)
+		snooze(random() % delay);
+	pthread_mutex_lock(&sLock);
+	dev = sim_find_device(device);
+	if ((NULL == dev) || (0 == dev->present)) {
+		pthread_mutex_unlock(&sLock);
+		return B_DEV_NOT_READY;
+	}
+	if (0 != dev->fail_requests) {
+		// the request never reaches the device
+		dev->fail_requests--;
+		pthread_mutex_unlock(&sLock);
+		return B_DEV_TIMEOUT;
+	}
+	dev->requests[req[0]]++;
+	switch (req[0]) {
+	case SIM_CMD_MODE:
+		dev->mode = req[1];
+		break;
+	case SIM_CMD_READ:
+		sim_report(report, SIM_CMD_READ, dev->counter);
+		sim_queue(dev, report, sizeof(report), B_OK);
+		break;
+	case SIM_CMD_WRITE:
+		if (0 != dev->ignore_writes)
+			dev->ignore_writes--;
+		else
+			dev->counter = ((uint64)req[1] << 32) | ((uint64)req[2] << 24) |
+				((uint64)req[3] << 16) | ((uint64)req[4] << 8) | req[5];
+		if (0 != dev->drop_acks) {
+			dev->drop_acks--;
+			break;
+		}
+		sim_report(report, SIM_CMD_ACK, SIM_CMD_WRITE);
+		transfer = sim_queue(dev, report, sizeof(report), B_OK);
+		if ((NULL != transfer) && (0 != dev->ack_delay))
+			transfer->due = system_time() + dev->ack_delay;
+		break;
+	}
+	pthread_mutex_unlock(&sLock);
+	*actualLength = length;
+	return B_OK;
+}
+
+static status_t
+sim_queue_interrupt
+(usb_pipe pipe, void *data, size_t dataLength, usb_callback_func callback,
+	void *callbackCookie)
+{
+	sim_device *dev;
+
+	sim_usb_check("queue_interrupt");
+	pthread_mutex_lock(&sLock);
+	dev = sim_find_device(pipe);
+	if ((NULL == dev) || (0 == dev->present)) {
+		pthread_mutex_unlock(&sLock);
+		return B_DEV_NOT_READY;
+	}
+	dev->queue_calls++;
+	if (0 != dev->fail_queues) {
+		dev->fail_queues--;
+		pthread_mutex_unlock(&sLock);
+		return B_NO_MEMORY;
+	}
+	if (0 != dev->queued) {
+		pthread_mutex_unlock(&sLock);
+		sim_error("interrupt transfer queued twice\n");
+		return B_BUSY;
+	}
+	dev->callback        = callback;
+	dev->callback_cookie = callbackCookie;
+	dev->data            = (uint8 *)data;
+	dev->length          = dataLength;
+	dev->queued          = 1;
+	pthread_mutex_unlock(&sLock);
+	return B_OK;
+}
+
+static status_t
+sim_cancel_queued_transfers
+(usb_pipe pipe)
+{
+	sim_device *dev;
+
+	sim_usb_check("cancel_queued_transfers");
+	pthread_mutex_lock(&sLock);
+	dev = sim_find_device(pipe);
+	if ((NULL != dev) && (0 != dev->queued))
+		sim_complete(dev, B_CANCELED, 0);
+	pthread_mutex_unlock(&sLock);
+	return B_OK;
+}
+
+static status_t
+sim_clear_feature
+(usb_id object, uint16 selector)
+{
+	sim_usb_check("clear_feature");
+	return B_OK;
+}
+
+static usb_module_info sUsbModule = {
+	{ B_USB_MODULE_NAME, 0, NULL },
+	sim_register_driver,
+	sim_install_notify,
+	sim_uninstall_notify,
+	sim_get_nth_configuration,
+	sim_set_configuration,
+	sim_send_request,
+	sim_queue_interrupt,
+	sim_cancel_queued_transfers,
+	sim_clear_feature
+};
+
+status_t
+get_module
+(const char *path, module_info **info)
+{
+	if ((0 != sFailGetModule) || (0 != strcmp(path, B_USB_MODULE_NAME)))
+		return B_ERROR;
+	__atomic_fetch_add(&sModuleRefs, 1, __ATOMIC_SEQ_CST);
+	*info = &sUsbModule.binfo;
+	return B_OK;
+}
+
+status_t
+put_module
+(const char *path)
+{
+	int32 threads = sim_threads();
+
+	// the driver may be unloaded right after, nothing may run in it
+	if (0 != threads)
+		sim_error("put_module with %" B_PRId32 " kernel threads alive\n",
+			threads);
+	__atomic_fetch_sub(&sModuleRefs, 1, __ATOMIC_SEQ_CST);
+	return B_OK;
+}
@@ -0,0 +1,89 @@
+/*
+ * $Id$
+ *
+ * Copyright (c) 2011 Takashi TOYOSHIMA <toyoshim@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Simulated kernel and usb stack for host tests of the YUREX driver */
+
+#ifndef _YUREX_SIM_H
+#define _YUREX_SIM_H
+
+#include <OS.h>
+#include <Drivers.h>
+
+// driver api functions (yurex.c)
+status_t init_driver(void);
+void uninit_driver(void);
+const char **publish_devices(void);
+device_hooks *find_device(const char *name);
+
+// yurex command definition, as seen on the wire
+#define SIM_CMD_EOF	0x0d
+#define SIM_CMD_ACK	0x21
+#define SIM_CMD_MODE	0x41
+#define SIM_CMD_VALUE	0x43
+#define SIM_CMD_READ	0x52
+#define SIM_CMD_WRITE	0x53
+#define SIM_REPORT_SIZE	8
+
+// simulated YUREX device
+typedef struct _sim_device sim_device;
+
+sim_device *sim_attach(uint16 maxPacketSize);
+void sim_detach(sim_device *dev);
+void sim_path(sim_device *dev, const char *node, char *path, size_t size);
+
+// device model: beats count the counter up and send a value report, or a
+// batch of value reports counting up one by one, a write request sets the
+// counter unless ignored and is acknowledged unless dropped
+void sim_beat(sim_device *dev, uint32 beats);
+void sim_batch(sim_device *dev, uint32 beats);
+void sim_drop_acks(sim_device *dev, uint32 count);
+void sim_ignore_writes(sim_device *dev, uint32 count);
+void sim_report(uint8 *report, uint8 command, uint64 bbu);
+void sim_push(sim_device *dev, const uint8 *data, size_t length,
+	status_t status);
+uint64 sim_counter(sim_device *dev);
+uint8 sim_mode(sim_device *dev);
+uint32 sim_requests(sim_device *dev, uint8 command);
+uint32 sim_queue_calls(sim_device *dev);
+
+// fault scripting: the next count queue_interrupt calls fail, the next
+// count control transfers never reach the device, write ACKs arrive after
+// the delay, and the device is unplugged from inside its next completion;
+// error, truncated and malformed completions are pushed with sim_push
+void sim_fail_queues(sim_device *dev, uint32 count);
+void sim_fail_requests(sim_device *dev, uint32 count);
+void sim_delay_acks(sim_device *dev, bigtime_t delay);
+void sim_remove_in_callback(sim_device *dev);
+
+// interrupt transfers complete only when pumped
+int sim_pump(sim_device *dev);
+int sim_pump_all(void);
+void sim_settle(bigtime_t quiet);
+
+// control transfers take a random time up to the delay, or the stall time
+// of a slow device
+void sim_request_delay(bigtime_t delay);
+void sim_stall(sim_device *dev, bigtime_t delay);
+
+// kernel state checks
+void sim_fail_get_module(int fail);
+int32 sim_threads(void);
+int32 sim_sems(void);
+int32 sim_errors(void);
+
+#endif // _YUREX_SIM_H
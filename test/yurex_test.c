@@ -0,0 +1,850 @@
+/*
+ * $Id$
+ *
+ * Copyright (c) 2011 Takashi TOYOSHIMA <toyoshim@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Host tests of the YUREX driver on the simulated usb stack */
+
+#include <pthread.h>
+#include <string.h>
+
+#include "yurex.h"
+#include "sim.h"
+
+static int sFailures = 0;	// failed checks
+#define CHECK(x) \
+	do { \
+		if (!(x)) { \
+			fprintf(stderr, "%s:%d: %s: check failed: %s\n", \
+				__FILE__, __LINE__, __func__, #x); \
+			sFailures++; \
+		} \
+	} while (0)
+
+// time for deferred work of the driver to finish
+static const bigtime_t kQuiet = 20000;		// usec
+static const bigtime_t kWriteTimeout = 300000;	// usec, > driver timeout
+
+//
+// node helpers
+//
+
+static void *
+node_open
+(sim_device *sim, const char *node)
+{
+	char path[256];
+	void *cookie = NULL;
+
+	sim_path(sim, node, path, sizeof(path));
+	publish_devices();
+	if (B_OK != find_device(path)->open(path, 0, &cookie))
+		return NULL;
+	return cookie;
+}
+
+static void
+node_close
+(void *cookie)
+{
+	device_hooks *hooks = find_device("");
+
+	hooks->close(cookie);
+	hooks->free(cookie);
+}
+
+static uint64
+node_read
+(void *cookie)
+{
+	char buf[32];
+	size_t len = sizeof(buf) - 1;
+
+	if (B_OK != find_device("")->read(cookie, 0, buf, &len))
+		return (uint64)-1;
+	buf[len] = '\0';
+	return strtoull(buf, NULL, 10);
+}
+
+static status_t
+node_write
+(void *cookie, uint64 value)
+{
+	char buf[32];
+	size_t len = snprintf(buf, sizeof(buf), "%" B_PRIu64 "\n", value);
+
+	return find_device("")->write(cookie, 0, buf, &len);
+}
+
+static status_t
+node_control
+(void *cookie, uint32 op, void *arg, size_t len)
+{
+	return find_device("")->control(cookie, op, arg, len);
+}
+
+static void
+node_stats
+(void *cookie, yurex_stats *stats)
+{
+	memset(stats, 0, sizeof(yurex_stats));
+	CHECK(B_OK == node_control(cookie, YUREX_GET_STATS, stats,
+		sizeof(yurex_stats)));
+}
+
+//
+// tests
+//
+
+static void
+test_write_round_trip
+(void)
+{
+	// a confirmed write is published without a read back
+	sim_device *sim = sim_attach(8);
+	void *bbu = node_open(sim, "bbu");
+	yurex_stats stats;
+
+	sim_beat(sim, 5);
+	sim_settle(kQuiet);
+	CHECK(5 == node_read(bbu));
+
+	CHECK(B_OK == node_write(bbu, 1000));
+	sim_settle(kQuiet);
+	CHECK(1000 == sim_counter(sim));
+	CHECK(1000 == node_read(bbu));
+	CHECK(1 == sim_requests(sim, SIM_CMD_READ));	// attach only
+	node_stats(bbu, &stats);
+	CHECK(1 == stats.writes_confirmed);
+	CHECK(1 == stats.round_trips_saved);
+	CHECK(0 == stats.verify_reads);
+
+	sim_beat(sim, 1);
+	sim_settle(kQuiet);
+	CHECK(1001 == node_read(bbu));
+
+	node_close(bbu);
+	sim_detach(sim);
+}
+
+static void
+test_lost_ack
+(void)
+{
+	// a lost ACK must not block publishing of later writes
+	sim_device *sim = sim_attach(8);
+	void *bbu = node_open(sim, "bbu");
+
+	sim_settle(kQuiet);
+	sim_drop_acks(sim, 1);
+	CHECK(B_OK == node_write(bbu, 100));
+	sim_settle(kQuiet);
+	CHECK(200 != node_read(bbu));
+	CHECK(B_OK == node_write(bbu, 200));
+	sim_settle(kQuiet);
+	snooze(kWriteTimeout);
+	sim_settle(kQuiet);
+	CHECK(200 == node_read(bbu));
+
+	// later writes are published on ACK again
+	CHECK(B_OK == node_write(bbu, 300));
+	sim_settle(kQuiet);
+	CHECK(300 == node_read(bbu));
+
+	// a lost ACK followed by a counter report
+	sim_drop_acks(sim, 1);
+	CHECK(B_OK == node_write(bbu, 400));
+	sim_settle(kQuiet);
+	sim_beat(sim, 1);
+	sim_settle(kQuiet);
+	CHECK(401 == node_read(bbu));
+
+	// a lost ACK alone is resolved by the timeout
+	sim_drop_acks(sim, 1);
+	CHECK(B_OK == node_write(bbu, 500));
+	sim_settle(kQuiet);
+	snooze(kWriteTimeout);
+	sim_settle(kQuiet);
+	CHECK(500 == node_read(bbu));
+	CHECK(500 == sim_counter(sim));
+
+	node_close(bbu);
+	sim_detach(sim);
+}
+
+static void
+test_verify_sampling
+(void)
+{
+	// every Nth confirmed write is read back, the others are not
+	sim_device *sim = sim_attach(8);
+	void *bbu = node_open(sim, "bbu");
+	uint32 verify = 3;
+	yurex_stats stats;
+	int i;
+
+	sim_settle(kQuiet);
+	CHECK(B_OK == node_control(bbu, YUREX_SET_VERIFY, &verify,
+		sizeof(verify)));
+	for (i = 0; i < 2 * 3; i++) {
+		CHECK(B_OK == node_write(bbu, 100 + i));
+		sim_settle(kQuiet);
+		CHECK(100 + i == node_read(bbu));
+	}
+	node_stats(bbu, &stats);
+	CHECK(2 == stats.verify_reads);
+	CHECK(2 * 3 - 2 == stats.round_trips_saved);
+	CHECK(0 == stats.verify_mismatches);
+	CHECK(1 + 2 == sim_requests(sim, SIM_CMD_READ));
+
+	// an acknowledged write the device did not take is found by the
+	// read back, the count rebases on the device value without beats
+	verify = YUREX_VERIFY_ALWAYS;
+	CHECK(B_OK == node_control(bbu, YUREX_SET_VERIFY, &verify,
+		sizeof(verify)));
+	sim_ignore_writes(sim, 1);
+	CHECK(B_OK == node_write(bbu, 1000));
+	sim_settle(kQuiet);
+	CHECK(105 == sim_counter(sim));
+	CHECK(105 == node_read(bbu));
+	node_stats(bbu, &stats);
+	CHECK(3 == stats.verify_reads);
+	CHECK(1 == stats.verify_mismatches);
+	sim_beat(sim, 2);
+	sim_settle(kQuiet);
+	CHECK(107 == node_read(bbu));
+
+	node_close(bbu);
+	sim_detach(sim);
+}
+
+typedef struct _writer {
+	void  *bbu;	// node to write
+	uint64 base;	// first value to write
+} writer;
+
+static void *
+write_loop
+(void *arg)
+{
+	writer *w = (writer *)arg;
+	int i;
+
+	for (i = 0; i < 50; i++)
+		node_write(w->bbu, w->base + i);
+	return NULL;
+}
+
+static int sPumpQuit = 0;
+
+static void *
+pump_loop
+(void *arg)
+{
+	while (0 == __atomic_load_n(&sPumpQuit, __ATOMIC_SEQ_CST))
+		if (0 == sim_pump_all())
+			snooze(100);
+	return NULL;
+}
+
+static void
+test_concurrent_writers
+(void)
+{
+	// the published value is the one the device holds at the end
+	sim_device *sim = sim_attach(8);
+	void *bbu = node_open(sim, "bbu");
+	pthread_t pump;
+	pthread_t threads[4];
+	writer writers[4];
+	int round;
+	int i;
+
+	sim_settle(kQuiet);
+	sim_request_delay(200);
+	for (round = 0; round < 20; round++) {
+		sPumpQuit = 0;
+		pthread_create(&pump, NULL, pump_loop, NULL);
+		for (i = 0; i < 4; i++) {
+			writers[i].bbu  = bbu;
+			writers[i].base = (uint64)(i + 1) * 1000000 + round * 1000;
+			pthread_create(&threads[i], NULL, write_loop, &writers[i]);
+		}
+		for (i = 0; i < 4; i++)
+			pthread_join(threads[i], NULL);
+		__atomic_store_n(&sPumpQuit, 1, __ATOMIC_SEQ_CST);
+		pthread_join(pump, NULL);
+		sim_settle(kQuiet);
+		CHECK(sim_counter(sim) == node_read(bbu));
+	}
+	sim_request_delay(0);
+
+	node_close(bbu);
+	sim_detach(sim);
+}
+
+static void
+test_report_order
+(void)
+{
+	// reports of one transfer take effect in transfer order
+	sim_device *sim = sim_attach(64);
+	void *bbu = node_open(sim, "bbu");
+	uint8 transfer[SIM_REPORT_SIZE * 2];
+
+	sim_settle(kQuiet);
+	CHECK(B_OK == node_control(bbu, YUREX_SET_READ_MODE,
+		&(uint32){ YUREX_READ_ABSOLUTE }, sizeof(uint32)));
+	sim_drop_acks(sim, 1);
+	CHECK(B_OK == node_write(bbu, 3));
+	sim_settle(kQuiet);
+
+	// [ACK WRITE][VALUE 5]: the device counted twice after the write
+	sim_report(&transfer[0], SIM_CMD_ACK, SIM_CMD_WRITE);
+	sim_report(&transfer[SIM_REPORT_SIZE], SIM_CMD_VALUE, 5);
+	sim_push(sim, transfer, sizeof(transfer), B_OK);
+	sim_settle(kQuiet);
+	CHECK(5 == node_read(bbu));
+
+	node_close(bbu);
+	sim_detach(sim);
+}
+
+static void
+test_batch
+(void)
+{
+	// every value report of a batch is counted, for each packet size
+	static const uint16 kSizes[] = { 8, 16, 64 };
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		sim_device *sim = sim_attach(kSizes[i]);
+		void *bbu = node_open(sim, "bbu");
+		uint64 interrupts;
+		yurex_stats stats;
+
+		sim_settle(kQuiet);
+		CHECK(B_OK == node_control(bbu, YUREX_SET_READ_MODE,
+			&(uint32){ YUREX_READ_DELTA }, sizeof(uint32)));
+		node_stats(bbu, &stats);
+		interrupts = stats.interrupts;
+		sim_batch(sim, 20);
+		sim_settle(kQuiet);
+		CHECK(20 == node_read(bbu));
+		node_stats(bbu, &stats);
+		CHECK(20 == stats.bbu);
+		CHECK((20 * SIM_REPORT_SIZE + kSizes[i] - 1) / kSizes[i] ==
+			stats.interrupts - interrupts);
+		CHECK(0 == stats.bad_packets);
+
+		node_close(bbu);
+		sim_detach(sim);
+	}
+}
+
+static void
+test_transfer_length
+(void)
+{
+	// reports are parsed up to actualLength, and a transfer is no longer
+	// than the endpoint
+	sim_device *sim = sim_attach(64);
+	void *bbu = node_open(sim, "bbu");
+	uint8 transfer[SIM_REPORT_SIZE * 3];
+	yurex_stats stats;
+
+	sim_settle(kQuiet);
+	sim_report(&transfer[0], SIM_CMD_VALUE, 5);
+	sim_report(&transfer[SIM_REPORT_SIZE], SIM_CMD_VALUE, 6);
+	sim_push(sim, transfer, SIM_REPORT_SIZE * 2, B_OK);
+	sim_settle(kQuiet);
+	CHECK(6 == node_read(bbu));
+
+	// the stale second report in the buffer is not looked at
+	sim_report(&transfer[0], SIM_CMD_VALUE, 7);
+	sim_push(sim, transfer, SIM_REPORT_SIZE, B_OK);
+	sim_settle(kQuiet);
+	CHECK(7 == node_read(bbu));
+
+	// a trailing partial report is a bad packet, the full one counts
+	sim_report(&transfer[0], SIM_CMD_VALUE, 10);
+	sim_report(&transfer[SIM_REPORT_SIZE], SIM_CMD_VALUE, 11);
+	sim_push(sim, transfer, SIM_REPORT_SIZE + 4, B_OK);
+	sim_settle(kQuiet);
+	CHECK(10 == node_read(bbu));
+	node_stats(bbu, &stats);
+	CHECK(1 == stats.bad_packets);
+	node_close(bbu);
+	sim_detach(sim);
+
+	// a 16 byte endpoint takes two of three reports
+	sim = sim_attach(16);
+	bbu = node_open(sim, "bbu");
+	sim_settle(kQuiet);
+	sim_report(&transfer[0], SIM_CMD_VALUE, 1);
+	sim_report(&transfer[SIM_REPORT_SIZE], SIM_CMD_VALUE, 2);
+	sim_report(&transfer[SIM_REPORT_SIZE * 2], SIM_CMD_VALUE, 3);
+	sim_push(sim, transfer, sizeof(transfer), B_OK);
+	sim_settle(kQuiet);
+	CHECK(2 == node_read(bbu));
+	node_close(bbu);
+	sim_detach(sim);
+}
+
+static void
+test_endpoint_size
+(void)
+{
+	// an endpoint not holding whole reports is not used
+	sim_device *sim = sim_attach(12);
+	void *bbu = node_open(sim, "bbu");
+	yurex_stats stats;
+
+	CHECK(NULL != bbu);
+	sim_beat(sim, 3);
+	sim_settle(kQuiet);
+	CHECK(0 == sim_queue_calls(sim));
+	node_stats(bbu, &stats);
+	CHECK(0 == stats.interrupts);
+	CHECK(0 == stats.requeue_failures);
+
+	node_close(bbu);
+	sim_detach(sim);
+}
+
+static void
+test_stats_length
+(void)
+{
+	// GET_STATS copies no more than the caller asks for
+	sim_device *sim = sim_attach(8);
+	void *bbu = node_open(sim, "bbu");
+	uint8 buf[sizeof(yurex_stats) + 8];
+	size_t i;
+
+	sim_settle(kQuiet);
+	memset(buf, 0xa5, sizeof(buf));
+	CHECK(B_OK == node_control(bbu, YUREX_GET_STATS, buf, 8));
+	for (i = 8; i < sizeof(buf); i++)
+		CHECK(0xa5 == buf[i]);
+	CHECK(B_OK == node_control(bbu, YUREX_GET_STATS, buf, sizeof(buf)));
+	for (i = sizeof(yurex_stats); i < sizeof(buf); i++)
+		CHECK(0xa5 == buf[i]);
+	CHECK(B_BAD_VALUE == node_control(bbu, YUREX_GET_STATS, buf, 0));
+
+	node_close(bbu);
+	sim_detach(sim);
+}
+
+static void
+test_error_backoff
+(void)
+{
+	// error completions are requeued with backoff, not at once
+	sim_device *sim = sim_attach(8);
+	void *bbu = node_open(sim, "bbu");
+	yurex_stats stats;
+	uint32 calls;
+	bigtime_t start;
+	int i;
+
+	sim_settle(kQuiet);
+	for (i = 0; i < 6; i++)
+		sim_push(sim, NULL, 0, B_DEV_CRC_ERROR);
+	calls = sim_queue_calls(sim);
+	start = system_time();
+	while (system_time() - start < 50000)
+		if (0 == sim_pump(sim))
+			snooze(1000);
+	CHECK(4 >= sim_queue_calls(sim) - calls);	// 10 + 20 + 40 msec
+
+	// the device recovers once the errors are over, the last gap is
+	// 320 msec
+	sim_settle(400000);
+	sim_beat(sim, 7);
+	sim_settle(kQuiet);
+	CHECK(7 == node_read(bbu));
+	node_stats(bbu, &stats);
+	CHECK(6 == stats.errors);
+	CHECK(1 == stats.recoveries);
+
+	node_close(bbu);
+	sim_detach(sim);
+}
+
+static void
+test_queue_fail
+(void)
+{
+	// a failed requeue is retried with backoff
+	sim_device *sim = sim_attach(8);
+	void *bbu = node_open(sim, "bbu");
+	yurex_stats stats;
+
+	sim_settle(kQuiet);
+	sim_fail_queues(sim, 2);
+	sim_beat(sim, 1);
+	sim_pump(sim);
+	sim_settle(100000);	// 10 + 20 msec
+	sim_beat(sim, 1);
+	sim_settle(kQuiet);
+	CHECK(2 == node_read(bbu));
+	node_stats(bbu, &stats);
+	CHECK(2 == stats.requeue_failures);
+	CHECK(0 == stats.lost_updates);
+	CHECK(1 == stats.recoveries);
+
+	node_close(bbu);
+	sim_detach(sim);
+}
+
+static void
+test_notify_interval
+(void)
+{
+	// a change held back by the interval is posted once it is over
+	sim_device *sim = sim_attach(8);
+	void *bbu = node_open(sim, "bbu");
+	yurex_subscription sub;
+	yurex_change msg;
+	int32 code;
+
+	sim_settle(kQuiet);
+	sub.port     = create_port(16, "yurex_test");
+	sub.interval = 100000;
+	CHECK(B_OK == node_control(bbu, YUREX_SUBSCRIBE, &sub, sizeof(sub)));
+
+	sim_beat(sim, 1);
+	sim_pump(sim);
+	CHECK(sizeof(msg) == read_port_etc(sub.port, &code, &msg, sizeof(msg),
+		B_RELATIVE_TIMEOUT, 0));
+	CHECK((YUREX_NOTIFY_CODE == code) && (1 == msg.bbu));
+	CHECK(0 == msg.dropped);
+
+	// two changes within the interval, only the latest one is posted
+	sim_beat(sim, 1);
+	sim_pump(sim);
+	sim_beat(sim, 1);
+	sim_pump(sim);
+	CHECK(0 == port_count(sub.port));
+	CHECK(sizeof(msg) == read_port_etc(sub.port, &code, &msg, sizeof(msg),
+		B_RELATIVE_TIMEOUT, 200000));
+	CHECK(3 == msg.bbu);
+	CHECK(1 == msg.dropped);
+
+	// nothing more without a change
+	snooze(200000);
+	CHECK(0 == port_count(sub.port));
+
+	node_close(bbu);
+	delete_port(sub.port);
+	sim_detach(sim);
+}
+
+static void
+burst
+(sim_device *sim, int beats, bigtime_t period)
+{
+	int i;
+
+	for (i = 0; i < beats; i++) {
+		sim_beat(sim, 1);
+		sim_pump(sim);
+		snooze(period);
+	}
+}
+
+static void
+test_rate_decay
+(void)
+{
+	// the rate decays while idle, and rate rules follow it without beats
+	sim_device *sim = sim_attach(8);
+	void *bbu = node_open(sim, "bbu");
+	void *anime = node_open(sim, "animation");
+	yurex_rule r = { YUREX_RULE_RATE_ABOVE, YUREX_ACTION_ANIMATION,
+		1000, 30000, 0 };
+	yurex_stats stats;
+
+	sim_settle(kQuiet);
+	CHECK(B_OK == node_control(bbu, YUREX_ADD_RULE, &r, sizeof(r)));
+	CHECK(0x00 == sim_mode(sim));
+
+	// fires once the duration is over, with no beat at that time
+	burst(sim, 3, 10000);
+	node_stats(bbu, &stats);
+	CHECK(1000 < stats.rate);
+	snooze(40000);
+	CHECK(0xff == sim_mode(sim));
+
+	// idle time brings the rate down, and re-arms the rule
+	snooze(300000);
+	node_stats(bbu, &stats);
+	CHECK(200 >= stats.rate);
+	CHECK(B_OK == find_device("")->write(anime, 0, "1", &(size_t){ 1 }));
+	CHECK(0x00 == sim_mode(sim));
+	burst(sim, 3, 10000);
+	snooze(40000);
+	CHECK(0xff == sim_mode(sim));
+
+	// a written value restarts the rate
+	CHECK(B_OK == node_write(bbu, 0));
+	sim_settle(kQuiet);
+	node_stats(bbu, &stats);
+	CHECK(0 == stats.rate);
+
+	node_close(anime);
+	node_close(bbu);
+	sim_detach(sim);
+}
+
+static void
+test_count_reset
+(void)
+{
+	// "on counter >= N, reset" writes once per crossing, and re-arms
+	sim_device *sim = sim_attach(8);
+	void *bbu = node_open(sim, "bbu");
+	yurex_rule r = { YUREX_RULE_COUNT_AT_LEAST, YUREX_ACTION_WRITE,
+		5, 0, 0 };
+
+	sim_settle(kQuiet);
+	CHECK(B_OK == node_control(bbu, YUREX_ADD_RULE, &r, sizeof(r)));
+	sim_beat(sim, 3);
+	sim_settle(kQuiet);
+	CHECK(0 == sim_requests(sim, SIM_CMD_WRITE));
+
+	// two reports above the threshold, one write
+	sim_beat(sim, 2);
+	sim_beat(sim, 1);
+	sim_settle(kQuiet);
+	CHECK(1 == sim_requests(sim, SIM_CMD_WRITE));
+	CHECK(0 == sim_counter(sim));
+	CHECK(0 == node_read(bbu));
+
+	// the reset has left the condition, the next crossing fires again
+	sim_beat(sim, 4);
+	sim_settle(kQuiet);
+	CHECK(1 == sim_requests(sim, SIM_CMD_WRITE));
+	CHECK(4 == node_read(bbu));
+	sim_beat(sim, 1);
+	sim_settle(kQuiet);
+	CHECK(2 == sim_requests(sim, SIM_CMD_WRITE));
+	CHECK(0 == sim_counter(sim));
+	CHECK(0 == node_read(bbu));
+
+	node_close(bbu);
+	sim_detach(sim);
+}
+
+static void
+test_read_delta
+(void)
+{
+	// delta reads count beats across the 40-bit wrap, per cookie, and
+	// not across writes
+	sim_device *sim = sim_attach(8);
+	void *delta = node_open(sim, "bbu");
+	void *other = node_open(sim, "bbu");
+	void *plain = node_open(sim, "bbu");
+	void *anime = node_open(sim, "animation");
+
+	sim_settle(kQuiet);
+	CHECK(B_OK == node_write(plain, 0xffffffffffULL));
+	sim_settle(kQuiet);
+	CHECK(0xffffffffffULL == node_read(plain));
+	CHECK(B_OK == node_control(delta, YUREX_SET_READ_MODE,
+		&(uint32){ YUREX_READ_DELTA }, sizeof(uint32)));
+	CHECK(B_OK == node_control(other, YUREX_SET_READ_MODE,
+		&(uint32){ YUREX_READ_DELTA }, sizeof(uint32)));
+
+	// 0xffffffffff -> 2 is three beats
+	sim_beat(sim, 3);
+	sim_settle(kQuiet);
+	CHECK(2 == node_read(plain));
+	CHECK(3 == node_read(delta));
+
+	// an absolute write from another cookie adds no beats
+	CHECK(B_OK == node_write(plain, 500));
+	sim_settle(kQuiet);
+	CHECK(500 == node_read(plain));
+	CHECK(0 == node_read(delta));
+
+	// each cookie keeps its own baseline
+	sim_beat(sim, 2);
+	sim_settle(kQuiet);
+	CHECK(2 == node_read(delta));
+	sim_beat(sim, 4);
+	sim_settle(kQuiet);
+	CHECK(4 == node_read(delta));
+	CHECK(3 + 2 + 4 == node_read(other));
+	CHECK(0 == node_read(other));
+
+	// only bbu nodes have a read mode
+	CHECK(B_BAD_VALUE == node_control(anime, YUREX_SET_READ_MODE,
+		&(uint32){ YUREX_READ_DELTA }, sizeof(uint32)));
+	CHECK(B_BAD_VALUE == node_control(delta, YUREX_SET_READ_MODE,
+		&(uint32){ YUREX_READ_DELTA + 1 }, sizeof(uint32)));
+
+	node_close(anime);
+	node_close(plain);
+	node_close(other);
+	node_close(delta);
+	sim_detach(sim);
+}
+
+static void
+test_pattern_end
+(void)
+{
+	// a finite group pattern ends and restores every member node
+	sim_device *sim[2];
+	void *anime[2];
+	yurex_pattern pattern = { 10000, 10000, 2, 7 };
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		sim[i] = sim_attach(8);
+		anime[i] = node_open(sim[i], "animation");
+	}
+	sim_settle(kQuiet);
+	CHECK(B_OK == node_control(anime[0], YUREX_SET_PATTERN, &pattern,
+		sizeof(pattern)));
+	CHECK(B_OK == node_control(anime[1], YUREX_SET_PATTERN, &pattern,
+		sizeof(pattern)));
+	snooze(100000);
+	for (i = 0; i < 2; i++) {
+		CHECK(0x00 == sim_mode(sim[i]));	// animation on
+		CHECK(5 <= sim_requests(sim[i], SIM_CMD_MODE));
+	}
+
+	// and a pattern over a node set to off leaves it off
+	CHECK(B_OK == find_device("")->write(anime[0], 0, "0", &(size_t){ 1 }));
+	CHECK(B_OK == node_control(anime[0], YUREX_SET_PATTERN, &pattern,
+		sizeof(pattern)));
+	snooze(100000);
+	CHECK(0xff == sim_mode(sim[0]));
+
+	for (i = 0; i < 2; i++) {
+		node_close(anime[i]);
+		sim_detach(sim[i]);
+	}
+}
+
+static void
+test_slow_member
+(void)
+{
+	// a slow device running a pattern does not stall other devices
+	sim_device *slow = sim_attach(8);
+	sim_device *sim = sim_attach(8);
+	void *slow_anime = node_open(slow, "animation");
+	void *anime = node_open(sim, "animation");
+	yurex_pattern pattern = { 10000, 10000, 0, 0 };
+	bigtime_t worst = 0;
+	int i;
+
+	sim_settle(kQuiet);
+	sim_stall(slow, 100000);
+	CHECK(B_OK == node_control(slow_anime, YUREX_SET_PATTERN, &pattern,
+		sizeof(pattern)));
+	snooze(20000);
+	for (i = 0; i < 6; i++) {
+		bigtime_t start = system_time();
+		CHECK(B_OK == find_device("")->write(anime, 0, (0 != (i % 2))?
+			"1": "0", &(size_t){ 1 }));
+		worst = max_c(worst, system_time() - start);
+		snooze(10000);
+	}
+	CHECK(worst < 50000);
+	CHECK(0x00 == sim_mode(sim));
+
+	CHECK(B_OK == node_control(slow_anime, YUREX_CLEAR_PATTERN, NULL, 0));
+	sim_stall(slow, 0);
+	node_close(anime);
+	node_close(slow_anime);
+	sim_detach(sim);
+	sim_detach(slow);
+}
+
+//
+// test driver
+//
+
+typedef struct _test {
+	const char *name;	// test name
+	void (*func)(void);	// test function
+} test;
+
+static const test kTests[] = {
+	{ "write_round_trip", test_write_round_trip },
+	{ "lost_ack", test_lost_ack },
+	{ "verify_sampling", test_verify_sampling },
+	{ "concurrent_writers", test_concurrent_writers },
+	{ "report_order", test_report_order },
+	{ "batch", test_batch },
+	{ "transfer_length", test_transfer_length },
+	{ "endpoint_size", test_endpoint_size },
+	{ "stats_length", test_stats_length },
+	{ "error_backoff", test_error_backoff },
+	{ "queue_fail", test_queue_fail },
+	{ "notify_interval", test_notify_interval },
+	{ "rate_decay", test_rate_decay },
+	{ "count_reset", test_count_reset },
+	{ "read_delta", test_read_delta },
+	{ "pattern_end", test_pattern_end },
+	{ "slow_member", test_slow_member },
+	{ NULL, NULL }
+};
+
+int
+main
+(int argc, char **argv)
+{
+	const test *t;
+
+	// a failed init leaves nothing behind
+	sim_fail_get_module(1);
+	CHECK(B_OK != init_driver());
+	CHECK(0 == sim_threads());
+	CHECK(0 == sim_sems());
+	sim_fail_get_module(0);
+
+	if (B_OK != init_driver()) {
+		fprintf(stderr, "init_driver failed\n");
+		return 1;
+	}
+	for (t = kTests; NULL != t->name; t++) {
+		int failures = sFailures;
+		int errors = sim_errors();
+		if ((1 < argc) && (0 != strcmp(argv[1], t->name)))
+			continue;
+		t->func();
+		CHECK(errors == sim_errors());
+		printf("%-24s %s\n", t->name, (failures == sFailures)? "ok": "FAIL");
+	}
+	uninit_driver();
+	CHECK(0 == sim_threads());
+	CHECK(0 == sim_sems());
+	CHECK(0 == sim_errors());
+
+	if (0 != sFailures) {
+		printf("%d checks failed\n", sFailures);
+		return 1;
+	}
+	return 0;
+}
@@ -25,6 +25,8 @@
 #include <usb/USB_hid.h>
 #include <string.h>
 
+#include "yurex.h"
+
 //#define DEBUG_YUREX
 
 #if !defined(DEBUG_YUREX)
@@ -39,7 +41,7 @@
 static const char *kDriverName = DRIVER_NAME;
 
 // device name
-static const char *kDeviceName = "misc/" DRIVER_NAME "/%08ld/%s";
+static const char *kDeviceName = "misc/" DRIVER_NAME "/%08" B_PRId32 "/%s";
 
 // supported usb type
 #define USB_VENDOR_MICRODIA		0x0c45
@@ -61,33 +63,94 @@ int32 api_version = B_CUR_DRIVER_API_VERSION;
 #define USB_DESCRIPTOR_HID		0x21
 #define USB_DESCRIPTOR_HID_REPORT	0x22
 
+// interrupt transfers carry one or more fixed size reports
+#define YUREX_REPORT_SIZE		8
+#define YUREX_MAX_TRANSFER		64
+
 // usb module information
 static usb_module_info *gUsb;
 
+// rule instance variables
+typedef struct _rule {
+	yurex_rule rule;	// rule definition
+	bigtime_t  since;	// condition holds since (0: does not hold)
+	int        fired;	// action issued while condition holds?
+	int        pending;	// action waits for the scheduler?
+} rule;
+
 // device instance variables
 typedef struct _device {
 	struct _device *next;			// device list link
+	int32           ref;			// references (atomic)
+	int32           removed;		// device has been unplugged? (atomic)
 	usb_device      udev;			// usb device ID
 	char            name_bbu[256];		// bbu device pathname
 	char            name_anime[256];	// anime device pathname
 	size_t          ifno;			// interface ID
-	int             ep_detect;		// endpoint informations are valid?
+	int32           ep_detect;		// endpoint informations are valid? (atomic)
 	uint8           ep_address;		//   endpoint address
+	size_t          ep_size;		//   interrupt transfer size
 	usb_pipe        ep;			//   endpoint pipe handle
 	sem_id          sem;			// semaphoe to access work area
 	uint64          bbu;			//   BBU count value (in 40-bit)
+	int             bbu_valid;		//   bbu has been read once?
+	bigtime_t       bbu_time;		//   time bbu last changed
+	uint64          beats;			//   beats counted since attach
 	int		anime;			//   animation 0:off / 1:on
-	char		buf[8];			// dummy buffer
+	struct _dev_open *subscribers;		//   port subscriber list
+	bigtime_t       notify_at;		//   held back change is due
+	uint64          rate;			//   beats per minute (smoothed)
+	bigtime_t       rate_time;		//   time of last rate sample
+	rule            rules[YUREX_MAX_RULES];	//   reaction rules
+	int             rule_count;		//   number of rules
+	bigtime_t       rule_at;		//   rate rules change without beats
+	struct _schedule *sched;		// animation schedule (gSchedLock)
+	struct _device  *sched_next;		//   schedule member list link
+	yurex_stats     stats;			//   transfer statistics
+	bigtime_t       fault_since;		//   first fault not recovered yet
+	bigtime_t       requeue_at;		//   interrupt requeue retry time
+	bigtime_t       requeue_delay;		//   interrupt requeue backoff
+	sem_id          mode_lock;		// semaphoe to serialize mode requests
+	sem_id          write_lock;		// semaphoe to serialize writes
+	uint64          write_value;		//   last counter value written
+	uint32          write_pending;		//   writes not acknowledged yet
+	bigtime_t       write_time;		//   time of the last write or read
+	int             write_uncertain;	//   counter known only after a read?
+	uint32          write_verify;		//   read back every Nth write
+	uint32          write_count;		//   acknowledged writes
+	int             write_verifying;	//   read back of a write sampled?
+	uint32          work;			//   deferred work for the scheduler
+	struct _device *work_next;		// scheduler work list link
+	uint8		buf[YUREX_MAX_TRANSFER];	// interrupt buffer
 } device;
 
+// animation schedule variables
+typedef struct _schedule {
+	struct _schedule *next;		// schedule list link
+	yurex_pattern pattern;		// pattern definition
+	device       *devices;		// member devices
+	int           state;		// animation 0:off / 1:on
+	uint32        cycles;		// finished on/off cycles
+	bigtime_t     deadline;		// time of the next toggle
+} schedule;
+
 // transaction variables
 #define YUREX_DEVICE_TYPE_BBU	0
 #define YUREX_DEVICE_TYPE_ANIME	1
 typedef struct _dev_open {
 	device *dev;		// device instance variables
 	int     type;		// device type 0:bbu / 1:anime
-	uint8   buf[16];	// read buffer
+	uint8   buf[24];	// read buffer
 	size_t  buf_len;	// read buffer length
+	int     delta;		// read beats since the previous read?
+	uint64  beats_last;	// beats at the previous read
+	struct _dev_open *sub_next;	// subscriber list link
+	port_id   sub_port;	// subscribed port (valid if sub_active)
+	int       sub_active;	// subscribed to counter changes?
+	bigtime_t sub_interval;	// minimum interval between messages
+	bigtime_t sub_last;	// last time a message was posted
+	uint32    sub_dropped;	// messages dropped since the last post
+	int       sub_pending;	// latest change held back by the interval?
 } dev_open;
 
 // global variables
@@ -96,12 +159,24 @@ static uint32  gDeviceCount = 0;	// number of devices
 static char  **gDeviceNames = NULL;	// published device pathnames
 static device *gDeviceList  = NULL;	// device list
 
+// animation scheduler variables
+static const bigtime_t kMinPatternDuration = 10000;	// usec
+static const bigtime_t kMinRequeueDelay    = 10000;	// usec
+static const bigtime_t kMaxRequeueDelay    = 1000000;	// usec
+static const bigtime_t kWriteTimeout       = 250000;	// usec
+static sem_id    gSchedLock    = 0;	// semaphoe to access schedules
+static sem_id    gSchedWake    = 0;	// semaphoe to wake the scheduler
+static thread_id gSchedThread  = 0;	// scheduler thread
+static int       gSchedQuit    = 0;	// scheduler should exit?
+static schedule *gScheduleList = NULL;	// schedule list
+
 // callback definition
 static status_t device_added(const usb_device dev, void **cookie);
 static status_t device_removed(void *cookie);
 static status_t device_open(const char *name, uint32 flags, void **cookie);
 static status_t device_close(void *cookie);
 static status_t device_free(void *cookie);
+static status_t device_control(void *cookie, uint32 op, void *arg, size_t len);
 static status_t device_read(void *cookie, off_t position, void *buffer, size_t *length);
 static status_t device_write(void *cookie, off_t position, const void *buffer, size_t *length);
 
@@ -121,12 +196,43 @@ static usb_notify_hooks sNotifyHooks = {
 #define CMD_WRITE	0x53
 #define CMD_PADDING	0xff
 
+// BBU count value is a 40-bit counter
+#define BBU_MASK	0xffffffffffLL
+
+// deferred work run by the scheduler thread, the interrupt callback never
+// issues control transfers itself
+#define YUREX_WORK_REQUEUE	0x01	// retry queue_interrupt
+#define YUREX_WORK_READ		0x02	// read the counter back
+#define YUREX_WORK_ACTIONS	0x04	// issue fired rule actions
+#define YUREX_WORK_CLEAR_HALT	0x08	// clear the interrupt endpoint halt
+#define YUREX_WORK_MODE		0x10	// send the animation mode
+
 // yurex functions definition
 static void yurex_callback(void *cookie, status_t status, void *data, size_t actualLength);
+static void yurex_update(device *dev, uint64 bbu, int written);
 static void yurex_set_mode(device *dev, uint8 val);
 static void yurex_read_bbu(device *dev);
 static void yurex_write_bbu(device *dev, uint64 bbu);
+static void yurex_write_acked(device *dev);
+static int yurex_write_check(device *dev, uint8 command, uint64 value);
+static void yurex_write_uncertain(device *dev);
 static void yurex_interrupt(device *dev);
+static void yurex_requeue_later(device *dev);
+static status_t yurex_send_report(device *dev, uint8 *req);
+static int yurex_fault_stat(device *dev, uint64 *counter, int lost);
+static void yurex_release(device *dev);
+static bigtime_t yurex_notify(device *dev, bigtime_t now, int changed);
+static void yurex_unsubscribe(dev_open *open);
+static void yurex_set_anime(device *dev, int anime);
+static void yurex_sync_mode(device *dev);
+static void yurex_schedule_work(schedule *s);
+static uint64 yurex_rate(device *dev, bigtime_t when);
+static int yurex_update_rules(device *dev, uint64 bbu, bigtime_t when, int written);
+static status_t yurex_schedule_set(device *dev, const yurex_pattern *pattern);
+static void yurex_schedule_leave(device *dev);
+static status_t yurex_scheduler(void *arg);
+static bigtime_t yurex_tick(device *dev, bigtime_t now);
+static void yurex_work(device *dev);
 
 //
 // yurex functions
@@ -138,28 +244,148 @@ yurex_callback
 {
 	device *dev = (device *)cookie;
 	uint8 *req = (uint8 *)data;
-	TRACE("callback: cookie=%p, len=%d\n", cookie, actualLength);
-	TRACE(" cmd: %02x\n", req[0]);
+	TRACE("callback: cookie=%p, status=%lx, len=%d\n",
+		cookie, status, actualLength);
 
-	if ((CMD_VALUE == req[0]) || // BBU update notification
-		(CMD_READ  == req[0])) { // BBU read result
-		int i;
-		acquire_sem(dev->sem);
-		dev->bbu = 0;
-		for (i = 1; i <= 5; i++) {
-			dev->bbu <<= 8;
-			dev->bbu += req[i];
+	// transfers are canceled only on device removal
+	if (B_CANCELED == status) {
+		yurex_release(dev);
+		return;
+	}
+
+	acquire_sem(dev->sem);
+	dev->stats.interrupts++;
+	release_sem(dev->sem);
+
+	if (B_OK != status) {
+		// an error completion is retried with the requeue backoff
+		if (0 != yurex_fault_stat(dev, &dev->stats.errors, 1))
+			TRACE_ALWAYS("interrupt error: %lx\n", status);
+		if (B_DEV_STALLED == status) {
+			acquire_sem(dev->sem);
+			dev->work |= YUREX_WORK_CLEAR_HALT;
+			release_sem(dev->sem);
 		}
-		release_sem(dev->sem);
-		if (CMD_EOF != req[6])
-			TRACE_ALWAYS("invalid bbu delta EOF\n");
-		TRACE("bbu=%ld\n", dev->bbu);
-	} else if ((CMD_ACK == req[0]) && (CMD_WRITE == req[1]))
-		yurex_read_bbu(dev);
+		yurex_requeue_later(dev);
+		yurex_release(dev);
+		return;
+	}
 
-	// requeue interrupt
-	if (0 != dev->ep_detect)
+	if (0 == actualLength) {
+		if (0 != yurex_fault_stat(dev, &dev->stats.bad_packets, 1))
+			TRACE_ALWAYS("empty interrupt transfer\n");
+	} else {
+		// a transfer may carry several concatenated reports, they take
+		// effect in transfer order
+		size_t offset;
+		int update = 0;
+		uint64 bbu = 0;
+		for (offset = 0; offset < actualLength; offset += YUREX_REPORT_SIZE) {
+			uint8 *report = &req[offset];
+			size_t len = min_c(actualLength - offset, YUREX_REPORT_SIZE);
+			if ((CMD_VALUE == report[0]) || // BBU update notification
+				(CMD_READ  == report[0])) { // BBU read result
+				int i;
+				uint64 value = 0;
+				if ((7 > len) || (CMD_EOF != report[6])) {
+					if (0 != yurex_fault_stat(dev, &dev->stats.bad_packets, 1))
+						TRACE_ALWAYS("invalid bbu report: len=%d\n", len);
+					continue;
+				}
+				for (i = 1; i <= 5; i++) {
+					value <<= 8;
+					value += report[i];
+				}
+				switch (yurex_write_check(dev, report[0], value)) {
+				case 0:
+					// consecutive values are published once
+					bbu = value;
+					update = 1;
+					break;
+				case 1:
+					// read back result after an uncertain or mismatched
+					// write, rebase on it
+					if (0 != update)
+						yurex_update(dev, bbu, 0);
+					update = 0;
+					yurex_update(dev, value, 1);
+					break;
+				}
+			} else if (CMD_ACK == report[0]) {
+				if (2 > len) {
+					if (0 != yurex_fault_stat(dev, &dev->stats.bad_packets, 1))
+						TRACE_ALWAYS("invalid ack report: len=%d\n", len);
+				} else if (CMD_WRITE == report[1]) {
+					if (0 != update)
+						yurex_update(dev, bbu, 0);
+					update = 0;
+					yurex_write_acked(dev);
+				}
+			}
+		}
+		if (0 != update)
+			yurex_update(dev, bbu, 0);
+	}
+
+	// requeue interrupt, and drop the reference of this transfer
+	if (0 != atomic_get(&dev->ep_detect))
 		yurex_interrupt(dev);
+	yurex_release(dev);
+}
+
+void
+yurex_update
+(device *dev, uint64 bbu, int written)
+{
+	int actions;
+	int wake;
+	bigtime_t rule_at;
+	bigtime_t notify_at;
+	bigtime_t now = system_time();
+
+	acquire_sem(dev->sem);
+	if (0 != dev->fault_since) {
+		bigtime_t recovery = now - dev->fault_since;
+		dev->stats.recoveries++;
+		dev->stats.last_recovery = recovery;
+		if (recovery > dev->stats.max_recovery)
+			dev->stats.max_recovery = recovery;
+		dev->fault_since   = 0;
+		dev->requeue_delay = 0;
+	}
+	dev->stats.last_update = now;
+
+	// count beats across 40-bit wrap, a write or reset only rebases
+	if ((0 == written) && (0 != dev->bbu_valid)) {
+		if (bbu >= dev->bbu)
+			dev->beats += bbu - dev->bbu;
+		else if ((dev->bbu - bbu) > (BBU_MASK >> 1))
+			dev->beats += bbu + BBU_MASK + 1 - dev->bbu;
+	}
+	dev->bbu_valid = 1;
+
+	rule_at = dev->rule_at;
+	actions = yurex_update_rules(dev, bbu, now, written);
+	if (0 != actions)
+		dev->work |= YUREX_WORK_ACTIONS;
+	wake = (0 != actions) || ((0 != dev->rule_at) &&
+		((0 == rule_at) || (dev->rule_at < rule_at)));
+	if (bbu != dev->bbu) {
+		dev->bbu      = bbu;
+		dev->bbu_time = now;
+		notify_at = dev->notify_at;
+		dev->notify_at = yurex_notify(dev, now, 1);
+		if ((0 != dev->notify_at) &&
+			((0 == notify_at) || (dev->notify_at < notify_at)))
+			wake = 1;
+	}
+	release_sem(dev->sem);
+
+	// rule actions, rule ticks and held back changes are run by the
+	// scheduler
+	if (0 != wake)
+		release_sem(gSchedWake);
+	TRACE("bbu=%ld\n", bbu);
 }
 
 void
@@ -167,23 +393,14 @@ yurex_set_mode
 (device *dev, uint8_t val)
 {
 	uint8 req[8];
-	size_t actualLength;
 	status_t result;
 
 	memset(req, CMD_PADDING, sizeof(req));
 	req[0] = CMD_MODE;
 	req[1] = val;
 	req[2] = CMD_EOF;
-	result = gUsb->send_request(dev->udev,
-		USB_REQTYPE_INTERFACE_OUT |
-		USB_REQTYPE_CLASS,
-		B_USB_REQUEST_HID_SET_REPORT,
-		2 << 8, // Output Report
-		dev->ifno,
-		8,
-		req,
-		&actualLength);
-	TRACE("output report: result=%d, len=%d\n", result, actualLength);
+	result = yurex_send_report(dev, req);
+	TRACE("output report: result=%d\n", result);
 }
 
 void
@@ -192,21 +409,12 @@ yurex_read_bbu
 {
 	uint8 req[8];
 	status_t result;
-	size_t actualLength;
 
 	memset(req, CMD_PADDING, sizeof(req));
 	req[0] = CMD_READ;
 	req[1] = CMD_EOF;
-	result = gUsb->send_request(dev->udev,
-		USB_REQTYPE_INTERFACE_OUT |
-		USB_REQTYPE_CLASS,
-		B_USB_REQUEST_HID_SET_REPORT,
-		2 << 8, // Output Report
-		dev->ifno,
-		8,
-		req,
-		&actualLength);
-	TRACE("read_req: result=%d, len=%d\n", result, actualLength);
+	result = yurex_send_report(dev, req);
+	TRACE("read_req: result=%d\n", result);
 }
 
 void
@@ -215,7 +423,21 @@ yurex_write_bbu
 {
 	uint8 req[8];
 	status_t result;
-	size_t actualLength;
+	int arm;
+
+	// remember the value to publish it on ACK, writes go out in the order
+	// they are recorded
+	bbu &= BBU_MASK;
+	acquire_sem(dev->write_lock);
+	acquire_sem(dev->sem);
+	arm = (0 == dev->write_pending) && (0 == dev->write_uncertain);
+	dev->write_value = bbu;
+	dev->write_pending++;
+	dev->write_verifying = 0;
+	dev->write_time = system_time();
+	release_sem(dev->sem);
+	if (0 != arm)
+		release_sem(gSchedWake);	// arm the ACK timeout
 
 	memset(req, CMD_PADDING, sizeof(req));
 	req[0] = CMD_WRITE;
@@ -225,6 +447,186 @@ yurex_write_bbu
 	req[4] = (bbu >>  8) & 0xff;
 	req[5] = (bbu >>  0) & 0xff;
 	req[6] = CMD_EOF;
+	result = yurex_send_report(dev, req);
+	TRACE("write_req: result=%d\n", result);
+	if (B_OK != result) {
+		// the device may or may not have taken the value
+		acquire_sem(dev->sem);
+		if (0 != dev->write_pending)
+			dev->write_pending--;
+		yurex_write_uncertain(dev);
+		release_sem(dev->sem);
+		release_sem(gSchedWake);
+	}
+	release_sem(dev->write_lock);
+}
+
+void
+yurex_write_acked
+(device *dev)
+{
+	int publish = 0;
+	int wake;
+	uint64 bbu;
+
+	acquire_sem(dev->sem);
+	dev->stats.writes_confirmed++;
+	if (1 < dev->write_pending) {
+		// an older write, the latest one is still in flight
+		dev->write_pending--;
+	} else if (1 == dev->write_pending) {
+		// only the latest write carries the current value
+		dev->write_pending   = 0;
+		dev->write_uncertain = 0;
+		dev->write_count++;
+		publish = 1;
+		if ((YUREX_VERIFY_NEVER != dev->write_verify) &&
+			(0 == (dev->write_count % dev->write_verify))) {
+			dev->stats.verify_reads++;
+			dev->write_verifying = 1;
+			dev->work |= YUREX_WORK_READ;
+		} else
+			dev->stats.round_trips_saved++;
+	} else {
+		// pending writes have expired, the ACK can not be matched
+		dev->stats.verify_reads++;
+		yurex_write_uncertain(dev);
+	}
+	bbu  = dev->write_value;
+	wake = (0 != dev->work);
+	release_sem(dev->sem);
+
+	if (0 != publish)
+		yurex_update(dev, bbu, 1);
+	if (0 != wake)
+		release_sem(gSchedWake);
+}
+
+int
+yurex_write_check
+(device *dev, uint8 command, uint64 value)
+{
+	// returns 0 to count a counter report, 1 to rebase on it, -1 to drop it
+	int result = 0;
+	int verifying;
+
+	acquire_sem(dev->sem);
+	verifying = (CMD_READ == command) && (0 != dev->write_verifying);
+	if (CMD_READ == command)
+		dev->write_verifying = 0;
+	if (0 != dev->write_pending) {
+		// the report may precede the writes or follow a lost ACK
+		TRACE("counter report with %ld writes pending\n",
+			dev->write_pending);
+		dev->write_pending = 0;
+		yurex_write_uncertain(dev);
+		result = -1;
+	} else if (0 != dev->write_uncertain) {
+		// only the read back result is trusted again
+		if (CMD_READ == command) {
+			dev->write_uncertain = 0;
+			result = 1;
+		} else
+			result = -1;
+	} else if ((0 != verifying) && (value != dev->write_value)) {
+		// the device does not hold the acknowledged value
+		TRACE_ALWAYS("verify read mismatch: %" B_PRIu64 " != %" B_PRIu64 "\n",
+			value, dev->write_value);
+		dev->stats.verify_mismatches++;
+		result = 1;
+	}
+	release_sem(dev->sem);
+	if (0 > result)
+		release_sem(gSchedWake);
+	return result;
+}
+
+void
+yurex_write_uncertain
+(device *dev)
+{
+	// called with dev->sem held, the caller wakes the scheduler
+	dev->write_uncertain = 1;
+	dev->work |= YUREX_WORK_READ;
+}
+
+void
+yurex_set_anime
+(device *dev, int anime)
+{
+	acquire_sem(dev->sem);
+	dev->anime = anime;
+	release_sem(dev->sem);
+	yurex_sync_mode(dev);
+}
+
+void
+yurex_sync_mode
+(device *dev)
+{
+	// sends the mode the device should show now, a running pattern or the
+	// node setting; requests are serialized per device, so the last one
+	// carries the latest setting
+	int anime;
+
+	acquire_sem(dev->mode_lock);
+	acquire_sem(gSchedLock);
+	acquire_sem(dev->sem);
+	anime = (NULL != dev->sched)? dev->sched->state: dev->anime;
+	release_sem(dev->sem);
+	release_sem(gSchedLock);
+	yurex_set_mode(dev, (0 != anime)? 0x00: 0xff);
+	release_sem(dev->mode_lock);
+}
+
+void
+yurex_interrupt
+(device *dev)
+{
+	status_t result;
+
+	TRACE("yurex_interrupt(%p)\n", dev);
+	// the transfer holds a reference until its callback is done, as a
+	// callback may still run after device_removed
+	atomic_add(&dev->ref, 1);
+	result = gUsb->queue_interrupt(dev->ep,
+		dev->buf,
+		dev->ep_size,
+		&yurex_callback,
+		dev);
+	TRACE("queue_interrupt: cookie=%p, result=%d\n", dev, result);
+	if (B_OK == result)
+		return;
+
+	if (0 != yurex_fault_stat(dev, &dev->stats.requeue_failures, 0))
+		TRACE_ALWAYS("can not queue interrupt: %lx\n", result);
+	yurex_requeue_later(dev);
+	yurex_release(dev);
+}
+
+void
+yurex_requeue_later
+(device *dev)
+{
+	// let the scheduler requeue with backoff, the pipe is idle meanwhile
+	acquire_sem(dev->sem);
+	dev->requeue_delay = (0 == dev->requeue_delay)?
+		kMinRequeueDelay: min_c(dev->requeue_delay * 2, kMaxRequeueDelay);
+	dev->requeue_at = system_time() + dev->requeue_delay;
+	release_sem(dev->sem);
+	release_sem(gSchedWake);
+}
+
+status_t
+yurex_send_report
+(device *dev, uint8 *req)
+{
+	status_t result;
+	size_t actualLength;
+	bigtime_t start = system_time();
+	bigtime_t elapsed;
+	int bucket;
+
 	result = gUsb->send_request(dev->udev,
 		USB_REQTYPE_INTERFACE_OUT |
 		USB_REQTYPE_CLASS,
@@ -234,22 +636,501 @@ yurex_write_bbu
 		8,
 		req,
 		&actualLength);
-	TRACE("write_req: result=%d, len=%d\n", result, actualLength);
+
+	// log2 histogram of the synchronous round trip
+	elapsed = system_time() - start;
+	for (bucket = 0; (bucket < YUREX_LATENCY_BUCKETS - 1) &&
+		((elapsed >> (bucket + 1)) != 0); bucket++)
+		;
+	acquire_sem(dev->sem);
+	dev->stats.latency[bucket]++;
+	release_sem(dev->sem);
+
+	if ((B_OK != result) &&
+		(0 != yurex_fault_stat(dev, &dev->stats.request_failures,
+			(CMD_MODE != req[0])? 1: 0)))
+		TRACE_ALWAYS("send_request(%02x) failed: %lx\n", req[0], result);
+	return result;
 }
 
 void
-yurex_interrupt
+yurex_release
 (device *dev)
 {
-	status_t result;
+	// the usb attachment, every open cookie and a queued interrupt
+	// transfer hold a reference
+	if (1 != atomic_add(&dev->ref, -1))
+		return;
+
+	TRACE("free instance %p\n", dev);
+	delete_sem(dev->mode_lock);
+	delete_sem(dev->write_lock);
+	delete_sem(dev->sem);
+	free(dev);
+}
 
-	TRACE("yurex_interrupt(%p)\n", dev);
-	result = gUsb->queue_interrupt(dev->ep,
-		dev->buf,
-		8,
-		&yurex_callback,
-		dev);
-	TRACE("queue_interrupt: cookie=%p, result=%d\n", dev, result);
+int
+yurex_fault_stat
+(device *dev, uint64 *counter, int lost)
+{
+	// returns 1 on the first fault since the last valid report, so a
+	// persistent fault is logged once
+	int first;
+
+	acquire_sem(dev->sem);
+	(*counter)++;
+	if (0 != lost)
+		dev->stats.lost_updates++;
+	first = (0 == dev->fault_since);
+	if (0 != first)
+		dev->fault_since = system_time();
+	release_sem(dev->sem);
+	return first;
+}
+
+bigtime_t
+yurex_notify
+(device *dev, bigtime_t now, int changed)
+{
+	// called with dev->sem held; posts the latest change to subscribers
+	// whose interval is over, holds it back for the others, and returns
+	// the time the next held back change is due (0: none)
+	dev_open **link = &dev->subscribers;
+	bigtime_t deadline = 0;
+	yurex_change msg;
+
+	msg.device = dev->udev;
+	msg.bbu    = dev->bbu;
+	msg.when   = dev->bbu_time;
+	while (NULL != *link) {
+		dev_open *sub = *link;
+		status_t result;
+		if (0 != changed) {
+			// a held back change is superseded by the new one
+			if (0 != sub->sub_pending)
+				sub->sub_dropped++;
+			sub->sub_pending = 1;
+		}
+		if (0 == sub->sub_pending) {
+			link = &sub->sub_next;
+			continue;
+		}
+		if ((0 != sub->sub_last) &&
+			((now - sub->sub_last) < sub->sub_interval)) {
+			bigtime_t at = sub->sub_last + sub->sub_interval;
+			if ((0 == deadline) || (at < deadline))
+				deadline = at;
+			link = &sub->sub_next;
+			continue;
+		}
+		sub->sub_pending = 0;
+		msg.dropped = sub->sub_dropped;
+		// never block the usb callback on a full port
+		result = write_port_etc(sub->sub_port, YUREX_NOTIFY_CODE,
+			&msg, sizeof(msg), B_RELATIVE_TIMEOUT, 0);
+		if (B_OK == result) {
+			sub->sub_last    = now;
+			sub->sub_dropped = 0;
+		} else if (B_BAD_PORT_ID == result) {
+			// subscriber has gone away
+			TRACE("drop subscriber port %ld\n", sub->sub_port);
+			sub->sub_active = 0;
+			*link = sub->sub_next;
+			sub->sub_next = NULL;
+			continue;
+		} else
+			sub->sub_dropped++;
+		link = &sub->sub_next;
+	}
+	return deadline;
+}
+
+uint64
+yurex_rate
+(device *dev, bigtime_t when)
+{
+	// called with dev->sem held; no beat since rate_time bounds the rate
+	// to one beat per elapsed time, so it decays while the device is idle
+	uint64 limit;
+
+	if ((0 == dev->rate) || (0 == dev->rate_time) || (when <= dev->rate_time))
+		return dev->rate;
+	limit = 60000000LL / (when - dev->rate_time);
+	return min_c(dev->rate, limit);
+}
+
+int
+yurex_update_rules
+(device *dev, uint64 bbu, bigtime_t when, int written)
+{
+	// called with dev->sem held, before dev->bbu is updated
+	int i;
+	int count = 0;
+	uint64 rate;
+
+	// update smoothed rate on counting up, restart it on write or reset
+	if (0 != written) {
+		// a written value says nothing about the rate
+		dev->rate      = 0;
+		dev->rate_time = 0;
+	} else if ((bbu > dev->bbu) && (0 != dev->rate_time) &&
+		(when > dev->rate_time)) {
+		uint64 sample = (bbu - dev->bbu) * 60000000LL /
+			(when - dev->rate_time);
+		rate = yurex_rate(dev, when);
+		dev->rate = (0 == rate)? sample: (rate * 3 + sample) / 4;
+	} else if (bbu < dev->bbu)
+		dev->rate = 0;
+	if (bbu != dev->bbu)
+		dev->rate_time = when;
+	rate = yurex_rate(dev, when);
+
+	dev->rule_at = 0;
+	for (i = 0; i < dev->rule_count; i++) {
+		rule *r = &dev->rules[i];
+		int hold;
+		bigtime_t at;
+		if (YUREX_RULE_RATE_ABOVE == r->rule.condition)
+			hold = rate > r->rule.threshold;
+		else
+			hold = bbu >= r->rule.threshold;
+		if (0 == hold) {
+			// re-arm once the condition is left
+			r->since = 0;
+			r->fired = 0;
+			continue;
+		}
+		if (0 == r->since)
+			r->since = when;
+		if (YUREX_RULE_RATE_ABOVE == r->rule.condition) {
+			// without beats, the rule changes when the rate decays to the
+			// threshold, or when the duration is over
+			at = dev->rate_time + 1;
+			if (60000000LL > r->rule.threshold)
+				at += 60000000LL / (r->rule.threshold + 1);
+			if ((0 == r->fired) && (r->since + r->rule.duration < at))
+				at = r->since + r->rule.duration;
+			if ((0 == dev->rule_at) || (at < dev->rule_at))
+				dev->rule_at = at;
+		}
+		if ((0 != r->fired) ||
+			((YUREX_RULE_RATE_ABOVE == r->rule.condition) &&
+			 ((when - r->since) < r->rule.duration)))
+			continue;
+		r->fired   = 1;
+		r->pending = 1;
+		count++;
+	}
+	return count;
+}
+
+status_t
+yurex_schedule_set
+(device *dev, const yurex_pattern *pattern)
+{
+	schedule *s = NULL;
+
+	acquire_sem(gSchedLock);
+	if (0 != atomic_get(&dev->removed)) {
+		// device_removed has already left the schedule
+		release_sem(gSchedLock);
+		return B_DEV_NOT_READY;
+	}
+	yurex_schedule_leave(dev);
+
+	// devices in the same group share one schedule
+	if (0 != pattern->group) {
+		for (s = gScheduleList; NULL != s; s = s->next)
+			if (pattern->group == s->pattern.group)
+				break;
+	}
+	if (NULL == s) {
+		s = (schedule *)malloc(sizeof(schedule));
+		if (NULL == s) {
+			release_sem(gSchedLock);
+			return B_NO_MEMORY;
+		}
+		memset(s, 0, sizeof(schedule));
+		s->next = gScheduleList;
+		gScheduleList = s;
+	}
+	dev->sched      = s;
+	dev->sched_next = s->devices;
+	s->devices      = dev;
+
+	// (re)start the schedule in phase for all members
+	s->pattern  = *pattern;
+	s->state    = 1;
+	s->cycles   = 0;
+	s->deadline = system_time() + pattern->on;
+	yurex_schedule_work(s);
+	release_sem(gSchedLock);
+
+	release_sem(gSchedWake);
+	return B_OK;
+}
+
+void
+yurex_schedule_work
+(schedule *s)
+{
+	// called with gSchedLock held; the scheduler sends the new mode to
+	// every member without the lock, so a slow device stalls no one else
+	device *member;
+
+	for (member = s->devices; NULL != member; member = member->sched_next) {
+		acquire_sem(member->sem);
+		member->work |= YUREX_WORK_MODE;
+		release_sem(member->sem);
+	}
+}
+
+void
+yurex_schedule_leave
+(device *dev)
+{
+	// called with gSchedLock held
+	schedule *s = dev->sched;
+	device **link;
+
+	if (NULL == s)
+		return;
+	for (link = &s->devices; NULL != *link; link = &(*link)->sched_next) {
+		if (*link == dev) {
+			*link = dev->sched_next;
+			break;
+		}
+	}
+	dev->sched      = NULL;
+	dev->sched_next = NULL;
+	if (NULL != s->devices)
+		return;
+
+	// free the empty schedule
+	if (gScheduleList == s) gScheduleList = s->next;
+	else {
+		schedule *list;
+		for (list = gScheduleList; NULL != list; list = list->next) {
+			if (list->next == s) {
+				list->next = s->next;
+				break;
+			}
+		}
+	}
+	free(s);
+}
+
+status_t
+yurex_scheduler
+(void *arg)
+{
+	bigtime_t deadline = B_INFINITE_TIMEOUT;
+	TRACE("scheduler start\n");
+
+	for (;;) {
+		schedule *s;
+		schedule *next;
+		device *dev;
+		device *work;
+		bigtime_t now;
+
+		if (B_INFINITE_TIMEOUT == deadline)
+			acquire_sem(gSchedWake);
+		else
+			acquire_sem_etc(gSchedWake, 1, B_ABSOLUTE_TIMEOUT, deadline);
+
+		acquire_sem(gSchedLock);
+		if (0 != gSchedQuit) {
+			release_sem(gSchedLock);
+			break;
+		}
+		now = system_time();
+		deadline = B_INFINITE_TIMEOUT;
+		for (s = gScheduleList; NULL != s; s = next) {
+			device *member;
+			bigtime_t duration;
+			next = s->next;
+			if (s->deadline <= now) {
+				if (0 != s->state) {
+					s->state = 0;
+					duration = s->pattern.off;
+				} else {
+					s->cycles++;
+					if ((0 != s->pattern.repeat) &&
+						(s->cycles >= s->pattern.repeat)) {
+						// pattern is over, restore the node setting; the
+						// last leave frees s, so walk the detached list
+						device *members = s->devices;
+						TRACE("schedule %p done\n", s);
+						yurex_schedule_work(s);
+						while (NULL != (member = members)) {
+							members = member->sched_next;
+							yurex_schedule_leave(member);
+						}
+						continue;
+					}
+					s->state = 1;
+					duration = s->pattern.on;
+				}
+
+				// one wakeup toggles every member of the schedule
+				yurex_schedule_work(s);
+
+				s->deadline += duration;
+				if (s->deadline < now)
+					s->deadline = now + duration;	// fell behind
+			}
+			if (s->deadline < deadline)
+				deadline = s->deadline;
+		}
+
+		release_sem(gSchedLock);
+
+		// collect device work, pattern modes included, and run it without
+		// the global locks
+		acquire_sem(gLock);
+		work = NULL;
+		for (dev = gDeviceList; NULL != dev; dev = dev->next) {
+			bigtime_t at;
+			acquire_sem(dev->sem);
+			at = yurex_tick(dev, now);
+			if (0 != dev->work) {
+				atomic_add(&dev->ref, 1);
+				dev->work_next = work;
+				work = dev;
+			}
+			release_sem(dev->sem);
+			if (at < deadline)
+				deadline = at;
+		}
+		release_sem(gLock);
+		while (NULL != (dev = work)) {
+			work = dev->work_next;
+			yurex_work(dev);
+			yurex_release(dev);
+		}
+	}
+
+	TRACE("scheduler exit\n");
+	return B_OK;
+}
+
+bigtime_t
+yurex_tick
+(device *dev, bigtime_t now)
+{
+	// called with dev->sem held, returns the time of the next tick
+	bigtime_t deadline = B_INFINITE_TIMEOUT;
+
+	// retry interrupt requeue for a pipe that went idle
+	if (0 != dev->requeue_at) {
+		if (dev->requeue_at <= now) {
+			dev->requeue_at = 0;
+			dev->work |= YUREX_WORK_REQUEUE;
+		} else
+			deadline = dev->requeue_at;
+	}
+
+	// rate rules follow the decaying rate between beats
+	if (0 != dev->rule_at) {
+		if (dev->rule_at <= now) {
+			if (0 != yurex_update_rules(dev, dev->bbu, now, 0))
+				dev->work |= YUREX_WORK_ACTIONS;
+		}
+		if ((0 != dev->rule_at) && (dev->rule_at < deadline))
+			deadline = dev->rule_at;
+	}
+
+	// post changes held back by subscription intervals
+	if (0 != dev->notify_at) {
+		if (dev->notify_at <= now)
+			dev->notify_at = yurex_notify(dev, now, 0);
+		if ((0 != dev->notify_at) && (dev->notify_at < deadline))
+			deadline = dev->notify_at;
+	}
+
+	// give up on writes or a read back not answered in time
+	if ((0 != dev->write_pending) || (0 != dev->write_uncertain)) {
+		bigtime_t at = dev->write_time + kWriteTimeout;
+		if (at <= now) {
+			TRACE("write timeout, %ld writes pending\n", dev->write_pending);
+			dev->write_pending = 0;
+			yurex_write_uncertain(dev);
+		} else if (at < deadline)
+			deadline = at;
+	}
+	return deadline;
+}
+
+void
+yurex_work
+(device *dev)
+{
+	// runs deferred work of a device on the scheduler thread
+	int i;
+	int actions = 0;
+	uint32 work;
+	yurex_rule action[YUREX_MAX_RULES];
+
+	acquire_sem(dev->sem);
+	work = dev->work;
+	dev->work = 0;
+	for (i = 0; i < dev->rule_count; i++) {
+		if (0 == dev->rules[i].pending)
+			continue;
+		dev->rules[i].pending = 0;
+		action[actions++] = dev->rules[i].rule;
+	}
+	release_sem(dev->sem);
+	if (0 != atomic_get(&dev->removed))
+		return;
+
+	if (0 != (work & YUREX_WORK_MODE))
+		yurex_sync_mode(dev);
+	if (0 != (work & YUREX_WORK_CLEAR_HALT))
+		gUsb->clear_feature(dev->ep, USB_FEATURE_ENDPOINT_HALT);
+	if ((0 != (work & YUREX_WORK_REQUEUE)) &&
+		(0 != atomic_get(&dev->ep_detect))) {
+		TRACE("retry queue_interrupt(%p)\n", dev);
+		yurex_interrupt(dev);
+	}
+	if (0 != (work & YUREX_WORK_READ)) {
+		// no write may go out between the request and its timestamp
+		acquire_sem(dev->write_lock);
+		acquire_sem(dev->sem);
+		dev->write_time = system_time();
+		release_sem(dev->sem);
+		yurex_read_bbu(dev);
+		release_sem(dev->write_lock);
+	}
+	for (i = 0; i < actions; i++) {
+		TRACE("rule action %ld(%Ld)\n",
+			action[i].action, action[i].value);
+		if (YUREX_ACTION_ANIMATION == action[i].action)
+			yurex_set_anime(dev, (0 != action[i].value)? 1: 0);
+		else
+			yurex_write_bbu(dev, action[i].value);
+	}
+}
+
+void
+yurex_unsubscribe
+(dev_open *open)
+{
+	// called with open->dev->sem held
+	dev_open **link;
+
+	if (0 == open->sub_active)
+		return;
+	for (link = &open->dev->subscribers; NULL != *link;
+		link = &(*link)->sub_next) {
+		if (*link == open) {
+			*link = open->sub_next;
+			break;
+		}
+	}
+	open->sub_next   = NULL;
+	open->sub_active = 0;
 }
 
 //
@@ -277,8 +1158,31 @@ init_driver
 		return B_ERROR;
 
 	TRACE(" get usb module\n");
-	if (B_OK != get_module(B_USB_MODULE_NAME, (module_info **)&gUsb))
+	if (B_OK != get_module(B_USB_MODULE_NAME, (module_info **)&gUsb)) {
+		delete_sem(gLock);
+		return B_ERROR;
+	}
+
+	// the scheduler uses the usb module, start it only once acquired
+	TRACE(" start scheduler\n");
+	gScheduleList = NULL;
+	gSchedQuit = 0;
+	gSchedLock = create_sem(1, DRIVER_NAME "_schedule_sem");
+	gSchedWake = create_sem(0, DRIVER_NAME "_schedule_wake");
+	gSchedThread = B_ERROR;
+	if ((gSchedLock >= B_OK) && (gSchedWake >= B_OK))
+		gSchedThread = spawn_kernel_thread(&yurex_scheduler,
+			DRIVER_NAME "_scheduler", B_URGENT_DISPLAY_PRIORITY, NULL);
+	if (gSchedThread < B_OK) {
+		if (gSchedWake >= B_OK)
+			delete_sem(gSchedWake);
+		if (gSchedLock >= B_OK)
+			delete_sem(gSchedLock);
+		put_module(B_USB_MODULE_NAME);
+		delete_sem(gLock);
 		return B_ERROR;
+	}
+	resume_thread(gSchedThread);
 
 	TRACE(" register/install\n");
 	gUsb->register_driver(kDriverName, sSupportedDevices, 1, NULL);
@@ -296,6 +1200,21 @@ uninit_driver
 	TRACE(" uninstall\n");
 	gUsb->uninstall_notify(kDriverName);
 
+	// the scheduler may still be in a usb call, join it first
+	TRACE(" stop scheduler\n");
+	acquire_sem(gSchedLock);
+	gSchedQuit = 1;
+	release_sem(gSchedLock);
+	release_sem(gSchedWake);
+	wait_for_thread(gSchedThread, NULL);
+	while (NULL != gScheduleList) {
+		schedule *s = gScheduleList;
+		gScheduleList = s->next;
+		free(s);
+	}
+	delete_sem(gSchedWake);
+	delete_sem(gSchedLock);
+
 	TRACE(" put usb module\n");
 	put_module(B_USB_MODULE_NAME);
 
@@ -362,7 +1281,7 @@ find_device
 		&device_open,
 		&device_close,
 		&device_free,
-		NULL,
+		&device_control,
 		&device_read,
 		&device_write,
 		NULL,
@@ -385,37 +1304,39 @@ device_added
 	device *dev;
 	const usb_configuration_info *conf;
 	size_t i, j;
-	status_t result = B_OK;
 
 	TRACE("device_added(0x%08lx)\n", (int32)udev);
 
+	// get usb device default configuration
+	conf = gUsb->get_nth_configuration(udev, 0);
+	if (NULL == conf)
+		return B_ERROR;
+
 	// initialize instance
 	dev = (device *)malloc(sizeof(device));
-	*cookie = (void *)dev;
-	if (NULL == *cookie)
+	if (NULL == dev)
 		return B_ERROR;
 
 	memset(dev, 0, sizeof(device));
-	dev->sem   = create_sem(1, DRIVER_NAME "_instance_sem");
-	dev->udev  = udev;
-	dev->anime = 1;
-	snprintf(dev->name_bbu  , 256, kDeviceName, udev, "bbu");
-	snprintf(dev->name_anime, 256, kDeviceName, udev, "animation");
-
-	// add instance
-	acquire_sem(gLock);
-	TRACE(" add instance(%d)\n", gDeviceCount + 1);
-
-	dev->next = gDeviceList;
-	gDeviceList = dev;
-	gDeviceCount++;
-
-	release_sem(gLock);
-
-	// get usb device default configuration
-	conf = gUsb->get_nth_configuration(udev, 0);
-	if (NULL == conf)
+	dev->sem        = create_sem(1, DRIVER_NAME "_instance_sem");
+	dev->mode_lock  = create_sem(1, DRIVER_NAME "_mode_sem");
+	dev->write_lock = create_sem(1, DRIVER_NAME "_write_sem");
+	dev->ref        = 1;
+	dev->udev       = udev;
+	dev->anime      = 1;
+	snprintf(dev->name_bbu  , 256, kDeviceName, (int32)udev, "bbu");
+	snprintf(dev->name_anime, 256, kDeviceName, (int32)udev, "animation");
+	if ((dev->sem < B_OK) || (dev->mode_lock < B_OK) ||
+		(dev->write_lock < B_OK)) {
+		if (dev->sem >= B_OK)
+			delete_sem(dev->sem);
+		if (dev->mode_lock >= B_OK)
+			delete_sem(dev->mode_lock);
+		if (dev->write_lock >= B_OK)
+			delete_sem(dev->write_lock);
+		free(dev);
 		return B_ERROR;
+	}
 
 	// interface check
 	for (i = 0; i < conf->interface_count; i++) {
@@ -432,10 +1353,13 @@ device_added
 			if ((USB_ENDPOINT_ATTR_INTERRUPT != epd->attributes) ||
 				(USB_ENDPOINT_ADDR_DIR_IN !=
 				 (epd->endpoint_address & USB_ENDPOINT_ADDR_DIR_IN)) ||
-				(8 != epd->max_packet_size))
+				(0 == epd->max_packet_size) ||
+				(0 != (epd->max_packet_size % YUREX_REPORT_SIZE)))
 				continue;
 			dev->ep         = ep->handle;
 			dev->ep_address = epd->endpoint_address;
+			dev->ep_size    = min_c(epd->max_packet_size,
+				YUREX_MAX_TRANSFER);
 			dev->ep_detect  = 1;
 			dev->ifno       = i;
 			break;
@@ -450,10 +1374,22 @@ device_added
 	if (B_OK != gUsb->set_configuration(dev->udev, conf))
 		TRACE_ALWAYS("can not set default configuration\n");
 
+	// add instance once it is fully initialized
+	acquire_sem(gLock);
+	TRACE(" add instance(%d)\n", gDeviceCount + 1);
+
+	dev->next = gDeviceList;
+	gDeviceList = dev;
+	gDeviceCount++;
+
+	release_sem(gLock);
+	*cookie = (void *)dev;
+
 	// initialize yurex
 	yurex_set_mode(dev, 0);
 	yurex_read_bbu(dev);
-	yurex_interrupt(dev);
+	if (0 != dev->ep_detect)
+		yurex_interrupt(dev);
 
 	return B_OK;
 }
@@ -480,15 +1416,21 @@ device_removed
 		}
 	}
 	gDeviceCount--;
+	atomic_set(&dev->removed, 1);
 
 	release_sem(gLock);
 
+	// stop animation pattern
+	acquire_sem(gSchedLock);
+	yurex_schedule_leave(dev);
+	release_sem(gSchedLock);
+
 	// flush usb transactions
-	dev->ep_detect = 0; // forbit interrupt requeue
+	atomic_set(&dev->ep_detect, 0); // forbit interrupt requeue
 	gUsb->cancel_queued_transfers(dev->ep);
 
-	// free resource
-	free(cookie);
+	// free resource unless cookies are still open
+	yurex_release(dev);
 
 	return B_OK;
 }
@@ -521,6 +1463,7 @@ device_open
 			(0 == match)? "unmatch": "match");
 		if (1 == match) {
 			dev->dev = list;
+			atomic_add(&list->ref, 1);
 			break;
 		}
 	}
@@ -528,6 +1471,8 @@ device_open
 
 	if (NULL == dev->dev) {
 		TRACE_ALWAYS("cookie not found\n");
+		free(dev);
+		*cookie = NULL;
 		return B_ERROR;
 	}
 
@@ -546,14 +1491,150 @@ status_t
 device_free
 (void *cookie)
 {
+	dev_open *dev = (dev_open *)cookie;
 	TRACE("free()\n");
 	
-	if (NULL != cookie)
+	if (NULL != dev) {
+		if (NULL != dev->dev) {
+			acquire_sem(dev->dev->sem);
+			yurex_unsubscribe(dev);
+			release_sem(dev->dev->sem);
+			yurex_release(dev->dev);
+		}
 		free(cookie);
+	}
 
 	return B_ERROR;
 }
 
+status_t
+device_control
+(void *cookie, uint32 op, void *arg, size_t len)
+{
+	dev_open *dev = (dev_open *)cookie;
+	TRACE("control(%ld)\n", op);
+	if (0 != atomic_get(&dev->dev->removed))
+		return B_DEV_NOT_READY;
+
+	switch (op) {
+	case YUREX_SUBSCRIBE: {
+		yurex_subscription sub;
+		if (B_OK != user_memcpy(&sub, arg, sizeof(sub)))
+			return B_BAD_ADDRESS;
+		if ((sub.port < 0) || (sub.interval < 0))
+			return B_BAD_VALUE;
+		TRACE(" subscribe: port=%ld, interval=%Ld\n",
+			sub.port, sub.interval);
+		acquire_sem(dev->dev->sem);
+		if (0 == dev->sub_active) {
+			dev->sub_next = dev->dev->subscribers;
+			dev->dev->subscribers = dev;
+			dev->sub_active = 1;
+		}
+		dev->sub_port     = sub.port;
+		dev->sub_interval = sub.interval;
+		dev->sub_last     = 0;
+		dev->sub_dropped  = 0;
+		dev->sub_pending  = 0;
+		release_sem(dev->dev->sem);
+		return B_OK;
+	}
+	case YUREX_UNSUBSCRIBE:
+		TRACE(" unsubscribe\n");
+		acquire_sem(dev->dev->sem);
+		yurex_unsubscribe(dev);
+		release_sem(dev->dev->sem);
+		return B_OK;
+	case YUREX_ADD_RULE: {
+		yurex_rule r;
+		status_t result = B_OK;
+		if (B_OK != user_memcpy(&r, arg, sizeof(r)))
+			return B_BAD_ADDRESS;
+		if ((YUREX_RULE_COUNT_AT_LEAST < r.condition) ||
+			(YUREX_ACTION_WRITE < r.action) ||
+			(r.duration < 0) ||
+			(r.value > BBU_MASK))
+			return B_BAD_VALUE;
+		TRACE(" add rule: %ld(%Ld) -> %ld(%Ld)\n",
+			r.condition, r.threshold, r.action, r.value);
+		acquire_sem(dev->dev->sem);
+		if (YUREX_MAX_RULES > dev->dev->rule_count) {
+			rule *slot = &dev->dev->rules[dev->dev->rule_count++];
+			slot->rule    = r;
+			slot->since   = 0;
+			slot->fired   = 0;
+			slot->pending = 0;
+		} else
+			result = B_NO_MEMORY;
+		release_sem(dev->dev->sem);
+		return result;
+	}
+	case YUREX_CLEAR_RULES:
+		TRACE(" clear rules\n");
+		acquire_sem(dev->dev->sem);
+		dev->dev->rule_count = 0;
+		dev->dev->rule_at    = 0;
+		release_sem(dev->dev->sem);
+		return B_OK;
+	case YUREX_SET_PATTERN: {
+		yurex_pattern pattern;
+		if (B_OK != user_memcpy(&pattern, arg, sizeof(pattern)))
+			return B_BAD_ADDRESS;
+		if ((pattern.on < kMinPatternDuration) ||
+			(pattern.off < kMinPatternDuration))
+			return B_BAD_VALUE;
+		TRACE(" set pattern: %Ld/%Ld x %ld, group %ld\n",
+			pattern.on, pattern.off, pattern.repeat, pattern.group);
+		return yurex_schedule_set(dev->dev, &pattern);
+	}
+	case YUREX_CLEAR_PATTERN:
+		TRACE(" clear pattern\n");
+		acquire_sem(gSchedLock);
+		yurex_schedule_leave(dev->dev);
+		release_sem(gSchedLock);
+		yurex_sync_mode(dev->dev);
+		return B_OK;
+	case YUREX_SET_VERIFY: {
+		uint32 verify;
+		if (B_OK != user_memcpy(&verify, arg, sizeof(verify)))
+			return B_BAD_ADDRESS;
+		TRACE(" set verify: %ld\n", verify);
+		acquire_sem(dev->dev->sem);
+		dev->dev->write_verify = verify;
+		dev->dev->write_count  = 0;
+		release_sem(dev->dev->sem);
+		return B_OK;
+	}
+	case YUREX_SET_READ_MODE: {
+		uint32 mode;
+		if (B_OK != user_memcpy(&mode, arg, sizeof(mode)))
+			return B_BAD_ADDRESS;
+		if ((YUREX_READ_DELTA < mode) ||
+			(YUREX_DEVICE_TYPE_BBU != dev->type))
+			return B_BAD_VALUE;
+		TRACE(" set read mode: %ld\n", mode);
+		acquire_sem(dev->dev->sem);
+		dev->delta      = (YUREX_READ_DELTA == mode)? 1: 0;
+		dev->beats_last = dev->dev->beats;
+		release_sem(dev->dev->sem);
+		return B_OK;
+	}
+	case YUREX_GET_STATS: {
+		// a shorter buffer gets the leading fields only
+		yurex_stats stats;
+		if (0 == len)
+			return B_BAD_VALUE;
+		acquire_sem(dev->dev->sem);
+		stats      = dev->dev->stats;
+		stats.bbu  = dev->dev->bbu;
+		stats.rate = yurex_rate(dev->dev, system_time());
+		release_sem(dev->dev->sem);
+		return user_memcpy(arg, &stats, min_c(len, sizeof(stats)));
+	}
+	}
+	return B_DEV_INVALID_IOCTL;
+}
+
 status_t
 device_read
 (void *cookie, off_t position, void *buffer, size_t *length)
@@ -563,14 +1644,20 @@ device_read
 	TRACE("read(%d, %d)\n", position, *length);
 	if (0 == position) {
 		acquire_sem(dev->dev->sem);
-		if (YUREX_DEVICE_TYPE_BBU == dev->type)
-			dev->buf_len = snprintf(dev->buf, 16, "%ld\n", dev->dev->bbu);
-		else
-			dev->buf_len = snprintf(dev->buf, 16, "%d\n", dev->dev->anime);
+		if (YUREX_DEVICE_TYPE_ANIME == dev->type)
+			dev->buf_len = snprintf(dev->buf, sizeof(dev->buf), "%d\n",
+				dev->dev->anime);
+		else if (0 != dev->delta) {
+			dev->buf_len = snprintf(dev->buf, sizeof(dev->buf),
+				"%" B_PRIu64 "\n", dev->dev->beats - dev->beats_last);
+			dev->beats_last = dev->dev->beats;
+		} else
+			dev->buf_len = snprintf(dev->buf, sizeof(dev->buf),
+				"%" B_PRIu64 "\n", dev->dev->bbu);
 		release_sem(dev->dev->sem);
 	}
 	
-	len = dev->buf_len - position;
+	len = (position < dev->buf_len)? dev->buf_len - position: 0;
 	if (len > *length)
 		len = *length;
 	memcpy(buffer, &dev->buf[position], len);
@@ -585,27 +1672,29 @@ device_write
 {
 	dev_open *dev = (dev_open *)cookie;
 	TRACE("write(%d)\n", *length);
+	if (0 != atomic_get(&dev->dev->removed))
+		return B_DEV_NOT_READY;
 	if (0 == *length)
 		return B_OK;
 	
 	if (YUREX_DEVICE_TYPE_ANIME == dev->type) {
+		// an explicit setting cancels a running pattern
+		acquire_sem(gSchedLock);
+		yurex_schedule_leave(dev->dev);
+		release_sem(gSchedLock);
 		if ('0' == *(char *)buffer) {
 			TRACE(" animation off\n");
-			acquire_sem(dev->dev->sem);
-			dev->dev->anime = 0;
-			release_sem(dev->dev->sem);
-			yurex_set_mode(dev->dev, 0xff);
+			yurex_set_anime(dev->dev, 0);
 		} else {
 			TRACE(" animation on\n");
-			acquire_sem(dev->dev->sem);
-			dev->dev->anime = 1;
-			release_sem(dev->dev->sem);
-			yurex_set_mode(dev->dev, 0x00);
+			yurex_set_anime(dev->dev, 1);
 		}
 	} else {
 		uint64 bbu = 0;
 		const char *bbu_str = (const char *)buffer;
-		while (('0' <= *bbu_str) && (*bbu_str <= '9')) {
+		const char *bbu_end = bbu_str + *length;
+		while ((bbu_str < bbu_end) &&
+			('0' <= *bbu_str) && (*bbu_str <= '9')) {
 			bbu *= 10;
 			bbu += *bbu_str++ - '0';
 		}
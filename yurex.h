@@ -0,0 +1,112 @@
+/*
+ * $Id$
+ *
+ * Copyright (c) 2011 Takashi TOYOSHIMA <toyoshim@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Control interface of the YUREX driver, shared with applications */
+
+#ifndef _YUREX_H
+#define _YUREX_H
+
+#include <OS.h>
+#include <Drivers.h>
+
+// control op codes (ioctl on any node of a device)
+enum {
+	YUREX_SUBSCRIBE = B_DEVICE_OP_CODES_END + 1,	// yurex_subscription
+	YUREX_UNSUBSCRIBE,				// no argument
+	YUREX_ADD_RULE,					// yurex_rule
+	YUREX_CLEAR_RULES,				// no argument
+	YUREX_SET_PATTERN,				// yurex_pattern
+	YUREX_CLEAR_PATTERN,				// no argument
+	YUREX_GET_STATS,				// yurex_stats, len bytes of it
+	YUREX_SET_VERIFY,				// uint32, see below
+	YUREX_SET_READ_MODE				// uint32, see below
+};
+
+// read mode of a bbu node cookie for YUREX_SET_READ_MODE
+#define YUREX_READ_ABSOLUTE		0	// counter value
+#define YUREX_READ_DELTA		1	// beats since the previous read
+
+// write verification for YUREX_SET_VERIFY: a confirmed write is published
+// at once and read back from the device on every Nth write only, a write
+// whose ACK is lost or can not be matched is always read back; a read back
+// not holding the written value rebases the counter on the device value
+#define YUREX_VERIFY_NEVER		0
+#define YUREX_VERIFY_ALWAYS		1
+
+// subscription request; a change within the interval is held back, and the
+// latest one is posted once the interval is over
+typedef struct _yurex_subscription {
+	port_id   port;		// port to post change messages to
+	bigtime_t interval;	// minimum interval between messages (usec)
+} yurex_subscription;
+
+// change message posted to a subscribed port
+#define YUREX_NOTIFY_CODE	'yrxC'
+typedef struct _yurex_change {
+	uint32    device;	// usb device ID, as in the device pathname
+	uint32    dropped;	// changes superseded or lost since the previous one
+	uint64    bbu;		// BBU count value (in 40-bit)
+	bigtime_t when;		// system_time() of the update
+} yurex_change;
+
+// reaction rule evaluated by the driver on every counter update, and as the
+// rate decays while the device is idle
+#define YUREX_MAX_RULES			8
+#define YUREX_RULE_RATE_ABOVE		0	// rate > threshold for duration
+#define YUREX_RULE_COUNT_AT_LEAST	1	// counter >= threshold
+#define YUREX_ACTION_ANIMATION		0	// animation 0:off / 1:on
+#define YUREX_ACTION_WRITE		1	// write value to the counter
+typedef struct _yurex_rule {
+	uint32    condition;	// YUREX_RULE_*
+	uint32    action;	// YUREX_ACTION_*
+	uint64    threshold;	// beats per minute, or counter value
+	bigtime_t duration;	// time the rate must stay above (usec)
+	uint64    value;	// action argument
+} yurex_rule;
+
+// animation blink pattern run by the driver
+typedef struct _yurex_pattern {
+	bigtime_t on;		// animation on duration (usec)
+	bigtime_t off;		// animation off duration (usec)
+	uint32    repeat;	// number of on/off cycles (0: forever)
+	uint32    group;	// non-zero: share the schedule with this group
+} yurex_pattern;
+
+// transfer and fault statistics of a device
+#define YUREX_LATENCY_BUCKETS		24	// bucket i: < 2^(i+1) usec
+typedef struct _yurex_stats {
+	uint64    interrupts;		// completed interrupt transfers
+	uint64    errors;		// transfers completed with error status
+	uint64    bad_packets;		// truncated or malformed reports
+	uint64    requeue_failures;	// queue_interrupt failures
+	uint64    request_failures;	// failed control transfers
+	uint64    lost_updates;		// updates lost to the faults above
+	uint64    recoveries;		// faults followed by a valid report
+	bigtime_t last_recovery;	// fault to valid report time (usec)
+	bigtime_t max_recovery;		//   worst case of the above
+	bigtime_t last_update;		// system_time() of the last valid report
+	uint64    writes_confirmed;	// counter writes acknowledged
+	uint64    verify_reads;		// read backs issued after a write
+	uint64    round_trips_saved;	// read backs skipped after a write
+	uint64    bbu;			// BBU count value (in 40-bit)
+	uint64    rate;			// beats per minute (smoothed, decays)
+	uint32    latency[YUREX_LATENCY_BUCKETS];	// control transfer time
+	uint64    verify_mismatches;	// read backs not holding the written value
+} yurex_stats;
+
+#endif // _YUREX_H
@@ -0,0 +1,299 @@
+/*
+ * $Id$
+ *
+ * Copyright (c) 2011 Takashi TOYOSHIMA <toyoshim@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Live per-device monitor for the YUREX driver */
+
+#include <OS.h>
+#include <StorageDefs.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "yurex.h"
+
+// default settings
+static const char *kDeviceRoot = "/dev/misc/yurex";
+#define DEFAULT_INTERVAL	1000	// refresh interval (msec)
+#define RESCAN_PERIOD		10	// refreshes between directory scans
+
+// monitored device variables
+typedef struct _monitor {
+	struct _monitor *next;		// monitor list link
+	char        name[B_FILE_NAME_LENGTH];	// device directory name
+	int         fd;			// bbu node
+	int         seen;		// found by the last scan?
+	int         stats_valid;	// stats holds a previous sample?
+	int         text_only;		// YUREX_GET_STATS unsupported on fd?
+	yurex_stats stats;		// stats at the previous refresh
+	uint64      bbu;		// counter at the previous refresh
+	bigtime_t   bbu_time;		//   time the counter last changed
+	bigtime_t   time;		// time of the previous refresh
+} monitor;
+
+// global variables
+static monitor *gMonitorList = NULL;	// monitor list
+static const char *gRoot = NULL;	// device root directory
+static char gOutput[64 * 1024];		// screen buffer
+
+// yurextop functions definition
+static void yurextop_scan(void);
+static void yurextop_sample(monitor *mon, bigtime_t now);
+static uint64 yurextop_percentile(const uint32 *now, const uint32 *prev, int percent);
+static void usage(const char *name);
+
+//
+// yurextop functions
+//
+
+void
+yurextop_scan
+(void)
+{
+	DIR *dir;
+	struct dirent *entry;
+	monitor *mon;
+	monitor **link;
+
+	for (mon = gMonitorList; NULL != mon; mon = mon->next)
+		mon->seen = 0;
+
+	dir = opendir(gRoot);
+	if (NULL != dir) {
+		while (NULL != (entry = readdir(dir))) {
+			char path[B_PATH_NAME_LENGTH];
+			int fd;
+			if ('.' == entry->d_name[0])
+				continue;
+			for (mon = gMonitorList; NULL != mon; mon = mon->next)
+				if (0 == strcmp(mon->name, entry->d_name))
+					break;
+			if (NULL != mon) {
+				mon->seen = 1;
+				continue;
+			}
+
+			// open once, every refresh reuses the descriptor
+			snprintf(path, sizeof(path), "%s/%s/bbu", gRoot, entry->d_name);
+			fd = open(path, O_RDONLY);
+			if (fd < 0)
+				continue;
+			mon = (monitor *)malloc(sizeof(monitor));
+			if (NULL == mon) {
+				close(fd);
+				continue;
+			}
+			memset(mon, 0, sizeof(monitor));
+			strlcpy(mon->name, entry->d_name, sizeof(mon->name));
+			mon->fd   = fd;
+			mon->seen = 1;
+			mon->next = gMonitorList;
+			gMonitorList = mon;
+		}
+		closedir(dir);
+	}
+
+	// forget unplugged devices
+	link = &gMonitorList;
+	while (NULL != (mon = *link)) {
+		if (0 != mon->seen) {
+			link = &mon->next;
+			continue;
+		}
+		*link = mon->next;
+		close(mon->fd);
+		free(mon);
+	}
+}
+
+void
+yurextop_sample
+(monitor *mon, bigtime_t now)
+{
+	yurex_stats stats;
+	bigtime_t dt = now - mon->time;
+	double sec = (double)dt / 1000000.0;
+	uint64 bbu;
+	uint64 rate;
+	bigtime_t age;
+
+	if ((0 == mon->text_only) &&
+		(0 == ioctl(mon->fd, YUREX_GET_STATS, &stats, sizeof(stats)))) {
+		// one syscall gives everything
+		uint64 errors = stats.errors + stats.bad_packets +
+			stats.requeue_failures + stats.request_failures;
+		uint64 prev_errors = mon->stats.errors + mon->stats.bad_packets +
+			mon->stats.requeue_failures + mon->stats.request_failures;
+		age = (0 != stats.last_update)? now - stats.last_update: -1;
+		if ((0 != mon->stats_valid) && (0 < dt)) {
+			printf("%-10s %14" B_PRIu64 " %7" B_PRIu64 " %8.1f %8.1f %6.1f"
+				" %7" B_PRIu64 " %7" B_PRIu64 "\n",
+				mon->name, stats.bbu, stats.rate,
+				(age < 0)? -1.0: (double)age / 1000000.0,
+				(double)(stats.interrupts - mon->stats.interrupts) / sec,
+				(double)(errors - prev_errors) / sec,
+				yurextop_percentile(stats.latency, mon->stats.latency, 50),
+				yurextop_percentile(stats.latency, mon->stats.latency, 99));
+		} else {
+			// the rates need a previous sample
+			printf("%-10s %14" B_PRIu64 " %7" B_PRIu64 " %8.1f %8s %6s"
+				" %7s %7s\n",
+				mon->name, stats.bbu, stats.rate,
+				(age < 0)? -1.0: (double)age / 1000000.0,
+				"-", "-", "-", "-");
+		}
+		mon->stats = stats;
+		mon->stats_valid = 1;
+		mon->time = now;
+		return;
+	}
+
+	// fall back to the text node; stop trying the ioctl only if the driver
+	// does not know it, a device not ready now may answer the next time
+	if ((B_DEV_INVALID_IOCTL == errno) || (ENOTTY == errno))
+		mon->text_only = 1;
+	mon->stats_valid = 0;
+	{
+		char buf[32];
+		ssize_t len = pread(mon->fd, buf, sizeof(buf) - 1, 0);
+		if (len <= 0)
+			return;
+		buf[len] = '\0';
+		bbu = strtoull(buf, NULL, 10);
+	}
+	if ((0 == mon->time) || (bbu != mon->bbu))
+		mon->bbu_time = now;
+	rate = ((0 != mon->time) && (bbu > mon->bbu) && (0 < dt))?
+		(bbu - mon->bbu) * 60000000LL / dt: 0;
+	age = now - mon->bbu_time;
+	if (0 != mon->time) {
+		printf("%-10s %14" B_PRIu64 " %7" B_PRIu64 " %8.1f %8s %6s"
+			" %7s %7s\n",
+			mon->name, bbu, rate, (double)age / 1000000.0,
+			"-", "-", "-", "-");
+	} else {
+		printf("%-10s %14" B_PRIu64 " %7s %8.1f %8s %6s %7s %7s\n",
+			mon->name, bbu, "-", (double)age / 1000000.0,
+			"-", "-", "-", "-");
+	}
+	mon->bbu  = bbu;
+	mon->time = now;
+}
+
+uint64
+yurextop_percentile
+(const uint32 *now, const uint32 *prev, int percent)
+{
+	// upper bound of the bucket holding the percentile, 0 without samples
+	uint32 total = 0;
+	uint32 sum = 0;
+	int i;
+
+	for (i = 0; i < YUREX_LATENCY_BUCKETS; i++)
+		total += now[i] - prev[i];
+	if (0 == total)
+		return 0;
+	for (i = 0; i < YUREX_LATENCY_BUCKETS; i++) {
+		sum += now[i] - prev[i];
+		if ((uint64)sum * 100 >= (uint64)total * percent)
+			break;
+	}
+	return 2LL << i;
+}
+
+void
+usage
+(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-i interval_ms] [-n count] [-d device_root]\n", name);
+	exit(1);
+}
+
+int
+main
+(int argc, char **argv)
+{
+	bigtime_t interval = DEFAULT_INTERVAL * 1000LL;
+	bigtime_t work = 0;
+	bigtime_t cpu = -1;	// team cpu time at the previous refresh
+	bigtime_t last = 0;	//   and its start
+	double load = 0.0;
+	int count = -1;
+	int refresh;
+	int opt;
+
+	gRoot = kDeviceRoot;
+	while (-1 != (opt = getopt(argc, argv, "i:n:d:"))) {
+		switch (opt) {
+		case 'i':
+			interval = atoi(optarg) * 1000LL;
+			break;
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 'd':
+			gRoot = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (interval <= 0)
+		usage(argv[0]);
+	setvbuf(stdout, gOutput, _IOFBF, sizeof(gOutput));
+
+	for (refresh = 0; (count < 0) || (refresh < count); refresh++) {
+		monitor *mon;
+		int devices = 0;
+		team_usage_info usage;
+		bigtime_t start = system_time();
+
+		// user and kernel time spent since the previous refresh
+		if (B_OK == get_team_usage_info(B_CURRENT_TEAM, B_TEAM_USAGE_SELF,
+			&usage)) {
+			bigtime_t used = usage.user_time + usage.kernel_time;
+			if ((0 <= cpu) && (last < start))
+				load = (double)(used - cpu) * 100.0 / (start - last);
+			cpu = used;
+			last = start;
+		}
+
+		if (0 == (refresh % RESCAN_PERIOD))
+			yurextop_scan();
+
+		// whole screen goes out with one write
+		printf("\033[H\033[2J%-10s %14s %7s %8s %8s %6s %7s %7s\n",
+			"DEVICE", "COUNTER", "BPM", "AGE(s)", "INTR/s", "ERR/s",
+			"P50(us)", "P99(us)");
+		for (mon = gMonitorList; NULL != mon; mon = mon->next, devices++)
+			yurextop_sample(mon, start);
+		printf("\n%d devices in %s, refresh %" B_PRId64 " us (%.2f%% cpu)\n",
+			devices, gRoot, work, load);
+		fflush(stdout);
+		work = system_time() - start;	// shown on the next refresh
+
+		snooze_until(start + interval, B_SYSTEM_TIMEBASE);
+	}
+
+	return 0;
+}